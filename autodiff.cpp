@@ -0,0 +1,509 @@
+#include "autodiff.h"
+#include "stack.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <vector>
+
+using std::vector;
+
+namespace {
+
+Dual apply(NodeType type, Dual l, Dual r) {
+    switch (type) {
+        case NodeType::AddInverse: return Dual{-l.val, -l.dot};
+        case NodeType::Sin: return Dual{sin(l.val), cos(l.val) * l.dot};
+        case NodeType::Cos: return Dual{cos(l.val), -sin(l.val) * l.dot};
+        case NodeType::Exp: {
+            double val = exp(l.val);
+            return Dual{val, val * l.dot};
+        }
+        case NodeType::Log: return Dual{log(l.val), l.dot / l.val};
+        case NodeType::Add: return Dual{l.val + r.val, l.dot + r.dot};
+        case NodeType::Subtract: return Dual{l.val - r.val, l.dot - r.dot};
+        case NodeType::Multiply: return Dual{l.val * r.val, l.dot * r.val + l.val * r.dot};
+        case NodeType::Divide: return Dual{l.val / r.val, (l.dot * r.val - l.val * r.dot) / (r.val * r.val)};
+        default: {
+            double val = pow(l.val, r.val);
+
+            // power rule for constant exponents, which stays defined for negative bases
+            if (r.dot == 0) {
+                return Dual{val, l.dot == 0 ? 0 : r.val * pow(l.val, r.val - 1) * l.dot};
+            }
+
+            return Dual{val, val * (r.dot * log(l.val) + r.val * l.dot / l.val)};
+        }
+    }
+}
+
+Dual evaluate(const NodeBase& node, const Point& point, const Point& direction) {
+    checkStack();
+    NodeType type = node.getType();
+
+    switch (type) {
+        case NodeType::Val:
+            return Dual{static_cast<double>(static_cast<const NodeVal&>(node).val), 0};
+        case NodeType::Var: {
+            Symbol symbol = static_cast<const NodeVar&>(node).symbol;
+            return Dual{point[symbol], direction[symbol]};
+        }
+        case NodeType::AddInverse:
+        case NodeType::Sin:
+        case NodeType::Cos:
+        case NodeType::Exp:
+        case NodeType::Log:
+            return apply(type, evaluate(static_cast<const UnaryNodeBase&>(node).getArg(), point, direction), Dual{0, 0});
+        default: {
+            const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+            Dual left = evaluate(binary.getLeft(), point, direction);
+
+            return apply(type, left, evaluate(binary.getRight(), point, direction));
+        }
+    }
+}
+
+// true if only the constant term can be nonzero
+bool constant(const Series& a) {
+    return std::all_of(a.begin() + 1, a.end(), [](double x) { return x == 0; });
+}
+
+// c = a * b, c must be zeroed and distinct from a and b
+void multiply(const Series& a, const Series& b, Series& c) {
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i] == 0) {
+            continue;
+        }
+
+        for (size_t j = 0; i + j < c.size(); ++j) {
+            c[i + j] += a[i] * b[j];
+        }
+    }
+}
+
+// s = sin(a) and c = cos(a), which are defined in terms of each other
+void sinCos(const Series& a, Series& s, Series& c) {
+    s[0] = sin(a[0]);
+    c[0] = cos(a[0]);
+
+    for (size_t k = 1; k < a.size(); ++k) {
+        double ds = 0;
+        double dc = 0;
+
+        for (size_t j = 1; j <= k; ++j) {
+            ds += j * a[j] * c[k - j];
+            dc -= j * a[j] * s[k - j];
+        }
+
+        s[k] = ds / k;
+        c[k] = dc / k;
+    }
+}
+
+Series apply(NodeType type, const Series& a, const Series& b);
+
+// a^b; constant exponents use the power recurrence, which like the power rule stays defined for negative bases
+Series power(const Series& a, const Series& b) {
+    size_t n = a.size();
+
+    if (! constant(b)) {
+        return apply(NodeType::Exp, apply(NodeType::Multiply, b, apply(NodeType::Log, a, Series())), Series());
+    }
+
+    double p = b[0];
+    Series c(n, 0);
+
+    if (a[0] == 0 && p >= 0 && p == std::floor(p) && p <= INT_MAX) {
+        // the recurrence divides by a[0], so an integer power of a series without a constant term is multiplied out
+        Series square = a;
+        c[0] = 1;
+
+        for (unsigned int e = static_cast<unsigned int>(p); e > 0; e >>= 1) {
+            if (e & 1) {
+                Series product(n, 0);
+                multiply(c, square, product);
+                c = std::move(product);
+            }
+
+            if (e > 1) {
+                Series product(n, 0);
+                multiply(square, square, product);
+                square = std::move(product);
+            }
+        }
+
+        return c;
+    }
+
+    c[0] = pow(a[0], p);
+
+    for (size_t k = 1; k < n; ++k) {
+        double sum = 0;
+
+        for (size_t j = 1; j <= k; ++j) {
+            sum += ((p + 1) * j - k) * a[j] * c[k - j];
+        }
+
+        c[k] = sum / (k * a[0]);
+    }
+
+    return c;
+}
+
+// the series of one operation given those of its operands, b is unused by unary operations
+Series apply(NodeType type, const Series& a, const Series& b) {
+    size_t n = a.size();
+    Series c(n, 0);
+
+    switch (type) {
+        case NodeType::AddInverse:
+            for (size_t k = 0; k < n; ++k) {
+                c[k] = -a[k];
+            }
+            break;
+        case NodeType::Sin:
+        case NodeType::Cos: {
+            Series other(n, 0);
+            type == NodeType::Sin ? sinCos(a, c, other) : sinCos(a, other, c);
+            break;
+        }
+        case NodeType::Exp:
+            c[0] = exp(a[0]);
+
+            for (size_t k = 1; k < n; ++k) {
+                for (size_t j = 1; j <= k; ++j) {
+                    c[k] += j * a[j] * c[k - j];
+                }
+
+                c[k] /= k;
+            }
+            break;
+        case NodeType::Log:
+            c[0] = log(a[0]);
+
+            for (size_t k = 1; k < n; ++k) {
+                double sum = 0;
+
+                for (size_t j = 1; j < k; ++j) {
+                    sum += j * c[j] * a[k - j];
+                }
+
+                c[k] = (a[k] - sum / k) / a[0];
+            }
+            break;
+        case NodeType::Add:
+            for (size_t k = 0; k < n; ++k) {
+                c[k] = a[k] + b[k];
+            }
+            break;
+        case NodeType::Subtract:
+            for (size_t k = 0; k < n; ++k) {
+                c[k] = a[k] - b[k];
+            }
+            break;
+        case NodeType::Multiply:
+            multiply(a, b, c);
+            break;
+        case NodeType::Divide:
+            for (size_t k = 0; k < n; ++k) {
+                double sum = a[k];
+
+                for (size_t j = 1; j <= k; ++j) {
+                    sum -= b[j] * c[k - j];
+                }
+
+                c[k] = sum / b[0];
+            }
+            break;
+        default:
+            return power(a, b);
+    }
+
+    return c;
+}
+
+Series evaluate(const NodeBase& node, const Point& point, const Point& direction, unsigned int order) {
+    checkStack();
+    NodeType type = node.getType();
+    Series result(order + 1, 0);
+
+    switch (type) {
+        case NodeType::Val:
+            result[0] = static_cast<const NodeVal&>(node).val;
+            return result;
+        case NodeType::Var: {
+            Symbol symbol = static_cast<const NodeVar&>(node).symbol;
+            result[0] = point[symbol];
+
+            if (order > 0) {
+                result[1] = direction[symbol];
+            }
+            return result;
+        }
+        case NodeType::AddInverse:
+        case NodeType::Sin:
+        case NodeType::Cos:
+        case NodeType::Exp:
+        case NodeType::Log:
+            return apply(type, evaluate(static_cast<const UnaryNodeBase&>(node).getArg(), point, direction, order), result);
+        default: {
+            const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+            Series left = evaluate(binary.getLeft(), point, direction, order);
+
+            return apply(type, left, evaluate(binary.getRight(), point, direction, order));
+        }
+    }
+}
+
+// one operation of a forward pass; operands are earlier entries
+struct TapeEntry {
+    NodeType type;
+    unsigned int left;
+    unsigned int right;
+    Symbol symbol; // NodeType::Var
+    double val;
+};
+
+unsigned int record(const NodeBase& node, const Point& point, vector<TapeEntry>& tape) {
+    checkStack();
+    NodeType type = node.getType();
+    TapeEntry entry{type, 0, 0, 0, 0};
+
+    switch (type) {
+        case NodeType::Val:
+            entry.val = static_cast<const NodeVal&>(node).val;
+            break;
+        case NodeType::Var:
+            entry.symbol = static_cast<const NodeVar&>(node).symbol;
+            entry.val = point[entry.symbol];
+            break;
+        case NodeType::AddInverse:
+        case NodeType::Sin:
+        case NodeType::Cos:
+        case NodeType::Exp:
+        case NodeType::Log:
+            entry.left = record(static_cast<const UnaryNodeBase&>(node).getArg(), point, tape);
+            entry.val = apply(type, Dual{tape[entry.left].val, 0}, Dual{0, 0}).val;
+            break;
+        default: {
+            const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+            entry.left = record(binary.getLeft(), point, tape);
+            entry.right = record(binary.getRight(), point, tape);
+            entry.val = apply(type, Dual{tape[entry.left].val, 0}, Dual{tape[entry.right].val, 0}).val;
+            break;
+        }
+    }
+
+    tape.push_back(entry);
+
+    return tape.size() - 1;
+}
+
+// propagates adjoints from the last entry, the result, back to the variables
+Gradient backward(const vector<TapeEntry>& tape) {
+    Gradient gradient{tape.back().val, Point{}, {}};
+    vector<bool> listed;
+
+    for (const TapeEntry& entry : tape) {
+        if (entry.type != NodeType::Var) {
+            continue;
+        } else if (entry.symbol >= listed.size()) {
+            listed.resize(entry.symbol + 1, false);
+        }
+
+        if (! listed[entry.symbol]) {
+            listed[entry.symbol] = true;
+            gradient.symbols.push_back(entry.symbol);
+        }
+    }
+
+    vector<double> adjoint(tape.size(), 0);
+    adjoint.back() = 1;
+
+    for (unsigned int i = tape.size(); i-- > 0;) {
+        const TapeEntry& entry = tape[i];
+        double g = adjoint[i];
+
+        if (entry.type == NodeType::Var) {
+            gradient.partials.slot(entry.symbol) += g;
+            continue;
+        } else if (entry.type == NodeType::Val || g == 0) {
+            continue;
+        }
+
+        double a = tape[entry.left].val;
+        double b = tape[entry.right].val;
+
+        switch (entry.type) {
+            case NodeType::AddInverse: adjoint[entry.left] -= g; break;
+            case NodeType::Sin: adjoint[entry.left] += g * cos(a); break;
+            case NodeType::Cos: adjoint[entry.left] -= g * sin(a); break;
+            case NodeType::Exp: adjoint[entry.left] += g * entry.val; break;
+            case NodeType::Log: adjoint[entry.left] += g / a; break;
+            case NodeType::Add:
+                adjoint[entry.left] += g;
+                adjoint[entry.right] += g;
+                break;
+            case NodeType::Subtract:
+                adjoint[entry.left] += g;
+                adjoint[entry.right] -= g;
+                break;
+            case NodeType::Multiply:
+                adjoint[entry.left] += g * b;
+                adjoint[entry.right] += g * a;
+                break;
+            case NodeType::Divide:
+                adjoint[entry.left] += g / b;
+                adjoint[entry.right] -= g * a / (b * b);
+                break;
+            default:
+                adjoint[entry.left] += g * b * pow(a, b - 1);
+                adjoint[entry.right] += g * entry.val * log(a);
+                break;
+        }
+    }
+
+    return gradient;
+}
+
+}
+
+Dual evaluateDual(const NodeBase& node, const Point& point, Symbol wrt) {
+    Point direction;
+    direction.slot(wrt) = 1;
+
+    return evaluateDual(node, point, direction);
+}
+
+Dual evaluateDual(const FlatTree& tree, const Point& point, Symbol wrt) {
+    Point direction;
+    direction.slot(wrt) = 1;
+
+    return evaluateDual(tree, point, direction);
+}
+
+Dual evaluateDual(const NodeBase& node, const Point& point, const Point& direction) {
+    return evaluate(node, point, direction);
+}
+
+Dual evaluateDual(const FlatTree& tree, const Point& point, const Point& direction) {
+    if (tree.empty()) {
+        return Dual{0, 0};
+    }
+
+    unsigned int root = tree.getRoot();
+    vector<bool> used = tree.reachable(root);
+    vector<Dual> values(root + 1);
+
+    for (unsigned int i = 0; i <= root; ++i) {
+        if (! used[i]) {
+            continue;
+        }
+
+        NodeType type = tree.getType(i);
+
+        if (type == NodeType::Val) {
+            values[i] = Dual{static_cast<double>(tree.getVal(i)), 0};
+        } else if (type == NodeType::Var) {
+            values[i] = Dual{point[tree.getSymbol(i)], direction[tree.getSymbol(i)]};
+        } else {
+            values[i] = apply(type, values[tree.getLeft(i)], type >= NodeType::Add ? values[tree.getRight(i)] : Dual{0, 0});
+        }
+    }
+
+    return values[root];
+}
+
+Series evaluateTaylor(const NodeBase& node, const Point& point, Symbol wrt, unsigned int order) {
+    Point direction;
+    direction.slot(wrt) = 1;
+
+    return evaluateTaylor(node, point, direction, order);
+}
+
+Series evaluateTaylor(const FlatTree& tree, const Point& point, Symbol wrt, unsigned int order) {
+    Point direction;
+    direction.slot(wrt) = 1;
+
+    return evaluateTaylor(tree, point, direction, order);
+}
+
+Series evaluateTaylor(const NodeBase& node, const Point& point, const Point& direction, unsigned int order) {
+    return evaluate(node, point, direction, order);
+}
+
+Series evaluateTaylor(const FlatTree& tree, const Point& point, const Point& direction, unsigned int order) {
+    if (tree.empty()) {
+        return Series(order + 1, 0);
+    }
+
+    // shared subtrees are expanded once
+    unsigned int root = tree.getRoot();
+    vector<bool> used = tree.reachable(root);
+    vector<Series> values(root + 1);
+
+    for (unsigned int i = 0; i <= root; ++i) {
+        if (! used[i]) {
+            continue;
+        }
+
+        NodeType type = tree.getType(i);
+
+        if (type == NodeType::Val || type == NodeType::Var) {
+            values[i] = Series(order + 1, 0);
+            values[i][0] = type == NodeType::Val ? tree.getVal(i) : point[tree.getSymbol(i)];
+
+            if (type == NodeType::Var && order > 0) {
+                values[i][1] = direction[tree.getSymbol(i)];
+            }
+        } else {
+            values[i] = apply(type, values[tree.getLeft(i)], type >= NodeType::Add ? values[tree.getRight(i)] : Series());
+        }
+    }
+
+    return values[root];
+}
+
+Gradient evaluateGradient(const NodeBase& node, const Point& point) {
+    vector<TapeEntry> tape;
+    record(node, point, tape);
+
+    return backward(tape);
+}
+
+Gradient evaluateGradient(const FlatTree& tree, const Point& point) {
+    if (tree.empty()) {
+        return Gradient{0, Point{}, {}};
+    }
+
+    // the arena is already in evaluation order, so the tape is its reachable nodes
+    unsigned int root = tree.getRoot();
+    vector<bool> used = tree.reachable(root);
+    vector<unsigned int> position(root + 1);
+    vector<TapeEntry> tape;
+
+    for (unsigned int i = 0; i <= root; ++i) {
+        if (! used[i]) {
+            continue;
+        }
+
+        NodeType type = tree.getType(i);
+        TapeEntry entry{type, 0, 0, 0, 0};
+
+        if (type == NodeType::Val) {
+            entry.val = tree.getVal(i);
+        } else if (type == NodeType::Var) {
+            entry.symbol = tree.getSymbol(i);
+            entry.val = point[entry.symbol];
+        } else {
+            entry.left = position[tree.getLeft(i)];
+            entry.right = type >= NodeType::Add ? position[tree.getRight(i)] : 0;
+            entry.val = apply(type, Dual{tape[entry.left].val, 0}, Dual{tape[entry.right].val, 0}).val;
+        }
+
+        position[i] = tape.size();
+        tape.push_back(entry);
+    }
+
+    return backward(tape);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "tree.h"
+#include "flat.h"
+
+#include <vector>
+
+/*
+Automatic differentiation in double precision, sin/cos take radians.
+Forward mode carries a derivative alongside every value, so one pass over the
+expression yields f(a) and a directional derivative without building a
+symbolic derivative tree. Reverse mode records the forward pass on a tape and
+sweeps it backwards once, yielding the partial derivative for every variable
+at a small constant multiple of the cost of one evaluation.
+Taylor mode carries a truncated power series instead of one derivative:
+every node is evaluated on the coefficients of its operands by the series
+recurrences for products, quotients, exp, log, sin and cos, so the first N
+Taylor coefficients cost O(N^2) per node rather than a derivative tree per order.
+*/
+
+// values for variable symbols, unbound symbols evaluate to 0
+using Point = SymbolValues<double>;
+
+struct Gradient {
+    double val;
+    Point partials; // indexed by symbol
+    std::vector<Symbol> symbols; // the variables in the expression, in order of first use
+};
+
+struct Dual {
+    double val;
+    double dot; // derivative along the seed direction
+};
+
+// f(point) and df/dwrt at point
+Dual evaluateDual(const NodeBase& node, const Point& point, Symbol wrt);
+Dual evaluateDual(const FlatTree& tree, const Point& point, Symbol wrt);
+
+// f(point) and the derivative along direction, which gives d(symbol)/dt for each variable
+Dual evaluateDual(const NodeBase& node, const Point& point, const Point& direction);
+Dual evaluateDual(const FlatTree& tree, const Point& point, const Point& direction);
+
+// coefficients of f(point + t * direction) as a power series in t, from t^0 up to t^order;
+// coefficient k is the k-th derivative along direction divided by k!
+using Series = std::vector<double>;
+
+// the Taylor expansion of f about point in wrt, the other variables held at their values in point
+Series evaluateTaylor(const NodeBase& node, const Point& point, Symbol wrt, unsigned int order);
+Series evaluateTaylor(const FlatTree& tree, const Point& point, Symbol wrt, unsigned int order);
+
+Series evaluateTaylor(const NodeBase& node, const Point& point, const Point& direction, unsigned int order);
+Series evaluateTaylor(const FlatTree& tree, const Point& point, const Point& direction, unsigned int order);
+
+// f(point) and its partial derivatives with respect to every variable
+Gradient evaluateGradient(const NodeBase& node, const Point& point);
+Gradient evaluateGradient(const FlatTree& tree, const Point& point);
@@ -0,0 +1,293 @@
+#include "batch.h"
+#include "tree.h"
+#include "token.h"
+#include "parse.h"
+#include "rewrite.h"
+#include "cache.h"
+#include "parallel.h"
+#include "fingerprint.h"
+#include "jacobian.h"
+#include "stack.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+const unsigned int chunkLines = 256; // expressions handed to a worker at once
+const unsigned int chunksPerThread = 4; // in-flight chunks per worker
+
+enum class ChunkState {Empty, Read, Processing, Done};
+
+struct Chunk {
+    ChunkState state = ChunkState::Empty;
+    vector<string> lines;
+    string output;
+};
+
+// appends the result line for expression to output, without the newline
+void process(const string& expression, const BatchOptions& options, TreeCache* cache, ForkJoinPool* pool, string& output) {
+    try {
+        if (Lexer(expression).peek().type == TokenType::End) {
+            return;
+        }
+
+        std::unique_ptr<NodeBase> node = buildTree(expression);
+
+        if (options.mode == Mode::EVAL) {
+            printValue(*node, options.numbers, {}, output);
+        } else if (options.mode == Mode::FINGERPRINT) {
+            output += Fingerprinter().fingerprint(*node).toString();
+        } else {
+            Printer printer(output);
+            derivative(*node, intern(options.wrt), cache, pool)->print(printer);
+        }
+    } catch (const SyntaxError& e) {
+        output += "error at position " + std::to_string(e.getPos()) + ": " + e.what();
+    } catch (const std::domain_error& e) {
+        output += string("error: ") + e.what();
+    } catch (const DepthError& e) {
+        output += string("error: ") + e.what();
+    }
+}
+
+// chunk i lives in slot i % slots.size(); the reader, workers and writer each advance their own counter
+class Pipeline {
+public:
+    Pipeline(const BatchOptions& options, TreeCache* cache, ForkJoinPool* pool, std::istream& in, std::ostream& out)
+        : options(options), cache(cache), pool(pool), in(in), out(out), slots(options.threads * chunksPerThread),
+          readCount(0), workCount(0), writeCount(0), finished(false) {
+    }
+
+    void run() {
+        vector<std::thread> workers;
+
+        for (unsigned int i = 0; i < options.threads; ++i) {
+            workers.emplace_back(&Pipeline::work, this);
+        }
+
+        std::thread writer(&Pipeline::write, this);
+
+        read();
+
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        writer.join();
+    }
+
+private:
+    void read() {
+        vector<string> lines;
+        string line;
+
+        while (in) {
+            lines.clear();
+
+            while (lines.size() < chunkLines && std::getline(in, line)) {
+                lines.push_back(std::move(line));
+            }
+
+            if (lines.empty()) {
+                break;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return slot(readCount).state == ChunkState::Empty; });
+
+            Chunk& chunk = slot(readCount);
+            chunk.lines.swap(lines);
+            chunk.state = ChunkState::Read;
+            ++readCount;
+            changed.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        changed.notify_all();
+    }
+
+    void work() {
+        string output;
+
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return workCount < readCount || finished; });
+
+            if (workCount == readCount) {
+                return;
+            }
+
+            Chunk& chunk = slot(workCount++);
+            chunk.state = ChunkState::Processing;
+            lock.unlock();
+
+            output.clear();
+
+            for (const string& line : chunk.lines) {
+                process(line, options, cache, pool, output);
+                output += '\n';
+            }
+
+            lock.lock();
+            chunk.output.swap(output);
+            chunk.state = ChunkState::Done;
+            changed.notify_all();
+        }
+    }
+
+    void write() {
+        string output;
+
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] {
+                return slot(writeCount).state == ChunkState::Done || (finished && writeCount == readCount);
+            });
+
+            if (slot(writeCount).state != ChunkState::Done) {
+                return;
+            }
+
+            Chunk& chunk = slot(writeCount++);
+            output.swap(chunk.output);
+            chunk.lines.clear();
+            chunk.state = ChunkState::Empty;
+            changed.notify_all();
+            lock.unlock();
+
+            out << output;
+        }
+    }
+
+    Chunk& slot(size_t index) {
+        return slots[index % slots.size()];
+    }
+
+    const BatchOptions& options;
+    TreeCache* cache; // shared by the workers, may be null
+    ForkJoinPool* pool; // shared by the workers, may be null
+    std::istream& in;
+    std::ostream& out;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    vector<Chunk> slots;
+    size_t readCount;
+    size_t workCount;
+    size_t writeCount;
+    bool finished;
+};
+
+// parses every line of in as one system and writes its Jacobian, see batch.h; false after reporting an error
+bool writeJacobian(std::istream& in, std::ostream& out, const BatchOptions& options, TreeCache* cache) {
+    vector<std::unique_ptr<NodeBase>> equations;
+    string line;
+
+    while (std::getline(in, line)) {
+        try {
+            equations.push_back(Lexer(line).peek().type == TokenType::End ? nullptr : buildTree(line));
+        } catch (const SyntaxError& e) {
+            std::cerr << "cas: line " << equations.size() + 1 << ": error at position " << e.getPos() << ": " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    vector<const NodeBase*> system;
+
+    for (const std::unique_ptr<NodeBase>& equation : equations) {
+        system.push_back(equation.get());
+    }
+
+    SparseJacobian result;
+
+    try {
+        result = jacobian(system, cache, options.threads);
+    } catch (const DepthError& e) {
+        std::cerr << "cas: error: " << e.what() << std::endl;
+        return false;
+    }
+
+    string output = "jacobian " + std::to_string(system.size()) + " " + std::to_string(result.variables.size()) + " "
+                    + std::to_string(result.nonzeros()) + "\nvariables";
+
+    for (Symbol symbol : result.variables) {
+        output += " " + symbolName(symbol);
+    }
+
+    output += '\n';
+
+    for (unsigned int i = 0; i + 1 < result.rowStarts.size(); ++i) {
+        for (unsigned int k = result.rowStarts[i]; k < result.rowStarts[i + 1]; ++k) {
+            output += std::to_string(i) + " " + std::to_string(result.columns[k]) + " ";
+            Printer printer(output);
+            result.entries[k]->print(printer);
+            output += '\n';
+        }
+    }
+
+    out << output;
+
+    return true;
+}
+
+}
+
+int runBatch(const BatchOptions& options) {
+    std::ifstream in(options.input);
+
+    if (! in) {
+        std::cerr << "cas: cannot open " << options.input << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+
+    if (! options.output.empty()) {
+        file.open(options.output);
+
+        if (! file) {
+            std::cerr << "cas: cannot open " << options.output << std::endl;
+            return 1;
+        }
+    }
+
+    std::ostream& out = options.output.empty() ? std::cout : file;
+    BatchOptions normalized = options;
+    normalized.threads = std::max(1u, options.threads);
+
+    std::unique_ptr<TreeCache> cache;
+
+    if (options.cacheEntries > 0 && (options.mode == Mode::DIFF || options.mode == Mode::JACOBIAN)) {
+        cache = std::make_unique<TreeCache>(options.cacheEntries);
+    }
+
+    std::unique_ptr<ForkJoinPool> pool;
+
+    if (options.splitThreads > 0 && options.mode == Mode::DIFF) {
+        pool = std::make_unique<ForkJoinPool>(options.splitThreads);
+    }
+
+    if (options.mode == Mode::JACOBIAN && ! writeJacobian(in, out, normalized, cache.get())) {
+        return 1;
+    } else if (options.mode != Mode::JACOBIAN) {
+        Pipeline(normalized, cache.get(), pool.get(), in, out).run();
+    }
+
+    out.flush();
+
+    if (cache != nullptr) {
+        std::cerr << "cas: cache " << cache->getHits() << " hits, " << cache->getMisses() << " misses" << std::endl;
+    }
+
+    return out ? 0 : 1;
+}
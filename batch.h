@@ -0,0 +1,47 @@
+#pragma once
+
+#include "numeric.h"
+#include "codegen.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum class Mode{EVAL, DIFF, DVAL, GRAD, TAYLOR, FINGERPRINT, JACOBIAN}; // DVAL, GRAD and TAYLOR are interactive only,
+                                                                    // FINGERPRINT and JACOBIAN batch only
+
+struct BatchOptions {
+    std::string input;
+    std::string output; // stdout if empty
+    std::string serve; // a socket path or local port to serve requests on instead, see server.h
+    std::string emit; // an expression to write C source for instead, see codegen.h
+    std::vector<std::string> partials; // derivatives of emit written alongside it, such as "x^2 y"
+    CodeOptions code;
+    Mode mode = Mode::EVAL;
+    NumberType numbers = NumberType::Int; // Mode::EVAL evaluates in this type
+    std::string wrt = "x";
+    unsigned int threads = 1;
+    size_t cacheEntries = 0; // derivatives shared across lines, see cache.h; 0 turns the cache off
+    unsigned int splitThreads = 0; // extra threads that split large expressions, see parallel.h; 0 keeps each line on one thread
+};
+
+/*
+Streams expressions from options.input, one per line, through a pool of worker
+threads and writes one result line per input line, in input order. Only a fixed
+number of chunks are in flight at once, so memory stays bounded regardless of
+the input size.
+With split threads, Mode::DIFF also differentiates and simplifies the large
+subtrees of one expression in parallel, which helps when a few huge lines
+dominate the input; the output is the same either way.
+Mode::FINGERPRINT writes each expression's fingerprint, see fingerprint.h, so
+equivalent lines can be found with sort and uniq.
+Mode::JACOBIAN instead reads the whole input as one system, a line per
+equation, and writes its sparse Jacobian, see jacobian.h:
+    jacobian <rows> <columns> <nonzeros>
+    variables <the variable of each column>
+    <row> <column> <derivative>    one line per nonzero, by row then column
+Rows and columns count from 0, and a blank line is an empty row.
+With a cache, hit and miss counts are reported on stderr at the end.
+Returns a process exit status.
+*/
+int runBatch(const BatchOptions& options);
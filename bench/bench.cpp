@@ -0,0 +1,399 @@
+#include "generate.h"
+#include "tree.h"
+#include "token.h"
+#include "parse.h"
+#include "flat.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "autodiff.h"
+#include "numeric.h"
+#include "rewrite.h"
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <malloc.h>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+
+// heap accounting, the benchmarks are single threaded
+namespace {
+
+size_t allocations = 0;
+size_t liveBytes = 0;
+size_t peakBytes = 0;
+
+void* allocate(size_t size) {
+    void* p = malloc(size == 0 ? 1 : size);
+
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    ++allocations;
+    liveBytes += malloc_usable_size(p);
+    peakBytes = std::max(peakBytes, liveBytes);
+
+    return p;
+}
+
+void deallocate(void* p) {
+    if (p != nullptr) {
+        liveBytes -= malloc_usable_size(p);
+        free(p);
+    }
+}
+
+}
+
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void* p) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    deallocate(p);
+}
+
+namespace {
+
+struct SizeClass {
+    string name;
+    GeneratorOptions options;
+    unsigned int count; // expressions in the input set
+};
+
+struct Result {
+    string name;
+    string size;
+    double nsPerOp;
+    double nodesPerSec;
+    double allocsPerOp;
+    size_t peakBytes;
+};
+
+struct Options {
+    unsigned long long seed = 1;
+    double minTime = 0.2; // seconds per benchmark
+    string filter;
+    string json;
+    string baseline;
+    double threshold = 0.1; // slowdown reported as a regression
+};
+
+volatile size_t sink;
+
+unsigned int countNodes(const NodeBase& node) {
+    switch (node.getType()) {
+        case NodeType::Val:
+        case NodeType::Var:
+            return 1;
+        case NodeType::AddInverse:
+        case NodeType::Sin:
+        case NodeType::Cos:
+        case NodeType::Exp:
+        case NodeType::Log:
+            return 1 + countNodes(static_cast<const UnaryNodeBase&>(node).getArg());
+        default: {
+            const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+            return 1 + countNodes(binary.getLeft()) + countNodes(binary.getRight());
+        }
+    }
+}
+
+// runs op over every input until minTime has passed; nodes is the total across one pass over the inputs
+template <typename Op>
+Result measure(const string& name, const string& size, unsigned int inputs, size_t nodes, double minTime, Op op) {
+    using Clock = std::chrono::steady_clock;
+
+    size_t startAllocations = allocations;
+    peakBytes = liveBytes;
+    size_t startBytes = liveBytes;
+    size_t passes = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0;
+
+    do {
+        for (unsigned int i = 0; i < inputs; ++i) {
+            op(i);
+        }
+
+        ++passes;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minTime);
+
+    double ops = static_cast<double>(passes) * inputs;
+
+    return Result{name, size, elapsed * 1e9 / ops, nodes * passes / elapsed,
+                  (allocations - startAllocations) / ops, peakBytes - startBytes};
+}
+
+vector<Result> runSize(const SizeClass& sizeClass, const Options& options) {
+    Generator generator(sizeClass.options, options.seed);
+    vector<string> texts;
+    vector<vector<Token>> tokens;
+    vector<unique_ptr<NodeBase>> trees;
+    vector<unique_ptr<NodeBase>> derivatives;
+    vector<FlatTree> flats;
+    vector<Program> programs;
+    const Symbol x = intern("x");
+    vector<NativeFunction> functions;
+    size_t nodes = 0;
+    size_t derivativeNodes = 0;
+
+    for (unsigned int i = 0; i < sizeClass.count; ++i) {
+        texts.push_back(generator.next());
+        tokens.push_back(tokenize(texts.back()));
+        trees.push_back(buildTree(tokens.back()));
+        derivatives.push_back(trees.back()->differentiate(x));
+        flats.push_back(buildFlatTree(texts.back()));
+        programs.push_back(Program::compile(flats.back()));
+        functions.emplace_back(programs.back());
+        nodes += countNodes(*trees.back());
+        derivativeNodes += countNodes(*derivatives.back());
+    }
+
+    const Bindings bindings{{"x", 2}, {"y", 3}, {"z", 5}};
+    const vector<double> vars(bindings.data(), bindings.data() + bindings.size());
+    const SymbolValues<double> point{{"x", 2}, {"y", 3}, {"z", 5}};
+    const Fingerprinter fingerprinter;
+
+    // columns for batch evaluation, the same point in every row
+    const unsigned int rows = 256;
+    vector<double> doubleColumn(rows * 3);
+    vector<float> floatColumn(rows * 3);
+    Columns doubleColumns;
+    ColumnsOf<float> floatColumns;
+    vector<double> doubleOut(rows);
+    vector<float> floatOut(rows);
+
+    const char* names[] = {"x", "y", "z"};
+
+    for (unsigned int k = 0; k < 3; ++k) {
+        Symbol symbol = intern(names[k]);
+        std::fill_n(doubleColumn.data() + k * rows, rows, point[symbol]);
+        std::fill_n(floatColumn.data() + k * rows, rows, point[symbol]);
+        doubleColumns.slot(symbol) = doubleColumn.data() + k * rows;
+        floatColumns.slot(symbol) = floatColumn.data() + k * rows;
+    }
+    const string& size = sizeClass.name;
+    unsigned int n = sizeClass.count;
+    double t = options.minTime;
+    vector<Result> results;
+
+    auto run = [&](const string& name, size_t work, auto op) {
+        if (name.find(options.filter) != string::npos) {
+            results.push_back(measure(name, size, n, work, t, op));
+            std::cerr << std::left << std::setw(22) << name << std::setw(8) << size
+                      << std::right << std::setw(14) << std::fixed << std::setprecision(1) << results.back().nsPerOp << " ns/op" << std::endl;
+        }
+    };
+
+    run("tokenize", nodes, [&](unsigned int i) { sink = tokenize(texts[i]).size(); });
+    run("buildTree", nodes, [&](unsigned int i) { sink = buildTree(tokens[i])->getPrecedence(); });
+    run("evaluate", nodes, [&](unsigned int i) { sink = trees[i]->evaluate(bindings); });
+    run("evaluate.double", nodes, [&](unsigned int i) { sink = evaluateAs(*trees[i], point); });
+    run("differentiate", nodes, [&](unsigned int i) { sink = trees[i]->differentiate(x)->getPrecedence(); });
+    run("simplify", derivativeNodes, [&](unsigned int i) { sink = derivatives[i]->simplify()->getPrecedence(); });
+    run("diff+simplify", nodes, [&](unsigned int i) { sink = simplify(trees[i]->differentiate(x))->getPrecedence(); });
+    run("partial.order3", nodes, [&](unsigned int i) { sink = partialDerivative(*trees[i], {x, x, x}).back().nodes; });
+    run("taylor.order6", nodes, [&](unsigned int i) { sink = evaluateTaylor(*trees[i], point, x, 6)[6]; });
+    run("fingerprint", nodes, [&](unsigned int i) { sink = fingerprinter.fingerprint(*trees[i]).values[0]; });
+    run("clone", nodes, [&](unsigned int i) { sink = trees[i]->clone()->getPrecedence(); });
+    run("toString", nodes, [&](unsigned int i) { sink = trees[i]->toString().size(); });
+    run("flat.build", nodes, [&](unsigned int i) { sink = buildFlatTree(texts[i]).size(); });
+    run("bytecode.evaluate", nodes, [&](unsigned int i) { sink = programs[i].evaluate(bindings); });
+    run("bytecode.batch", nodes * rows, [&](unsigned int i) { programs[i].evaluate(doubleColumns, rows, doubleOut.data()); sink = doubleOut[0]; });
+    run("bytecode.batchf", nodes * rows, [&](unsigned int i) { programs[i].evaluate(floatColumns, rows, floatOut.data()); sink = floatOut[0]; });
+    run("jit.evaluate", nodes, [&](unsigned int i) { sink = functions[i].evaluate(vars.data()); });
+    run("jit.batch", nodes * rows, [&](unsigned int i) { functions[i].evaluate(doubleColumns, rows, doubleOut.data()); sink = doubleOut[0]; });
+
+    return results;
+}
+
+string toJson(const vector<Result>& results, const Options& options) {
+    std::ostringstream out;
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    out << "{\n  \"seed\": " << options.seed << ",\n  \"maxRssKb\": " << usage.ru_maxrss << ",\n  \"benchmarks\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"size\": \"" << r.size << "\", \"nsPerOp\": " << std::fixed << std::setprecision(1) << r.nsPerOp
+            << ", \"nodesPerSec\": " << std::setprecision(0) << r.nodesPerSec << ", \"allocsPerOp\": " << std::setprecision(2) << r.allocsPerOp
+            << ", \"peakBytes\": " << r.peakBytes << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+
+    return out.str();
+}
+
+// value of "key": in one benchmark object written by toJson()
+string field(const string& object, const string& key) {
+    size_t pos = object.find("\"" + key + "\":");
+
+    if (pos == string::npos) {
+        return "";
+    }
+
+    pos = object.find_first_not_of(" \"", pos + key.length() + 3);
+    size_t end = object.find_first_of("\",}", pos);
+
+    return object.substr(pos, end - pos);
+}
+
+// prints each benchmark's time relative to the baseline, returns false if any regressed beyond the threshold
+bool compare(const vector<Result>& results, const Options& options) {
+    std::ifstream in(options.baseline);
+
+    if (! in) {
+        std::cerr << "cas-bench: cannot open " << options.baseline << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    string line;
+
+    std::cout << "\nCompared to " << options.baseline << ":" << std::endl;
+
+    while (std::getline(in, line)) {
+        if (line.find("\"name\"") == string::npos) {
+            continue;
+        }
+
+        string name = field(line, "name");
+        string size = field(line, "size");
+        double before = std::strtod(field(line, "nsPerOp").c_str(), nullptr);
+
+        for (const Result& r : results) {
+            if (r.name != name || r.size != size || before <= 0) {
+                continue;
+            }
+
+            double ratio = r.nsPerOp / before;
+            bool regressed = ratio > 1 + options.threshold;
+            ok = ok && ! regressed;
+
+            std::cout << std::left << std::setw(22) << name << std::setw(8) << size << std::right << std::fixed
+                      << std::setprecision(2) << std::setw(8) << ratio << "x" << (regressed ? "  REGRESSION" : "") << std::endl;
+        }
+    }
+
+    return ok;
+}
+
+const double maxMinTime = 3600; // seconds
+
+// parses the whole of text as a decimal number from min to max, false if it isn't one (NaN included)
+template <typename T>
+bool parseNumber(const string& text, T min, T max, T& result) {
+    T val;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), val);
+
+    if (error != std::errc() || end != text.data() + text.size() || ! (val >= min && val <= max)) {
+        return false;
+    }
+
+    result = val;
+
+    return true;
+}
+
+void usage() {
+    std::cerr << "Usage: cas-bench [--seed <n>] [--min-time <seconds>] [--filter <name>] [--json <file>] "
+                 "[--baseline <file> [--threshold <fraction>]]" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        string val = argv[i + 1];
+
+        if (arg == "--seed" && parseNumber(val, 0ull, ULLONG_MAX, options.seed)) {
+        } else if (arg == "--min-time" && parseNumber(val, 0.0, maxMinTime, options.minTime)) {
+        } else if (arg == "--filter") {
+            options.filter = val;
+        } else if (arg == "--json") {
+            options.json = val;
+        } else if (arg == "--baseline") {
+            options.baseline = val;
+        } else if (arg == "--threshold" && parseNumber(val, 0.0, std::numeric_limits<double>::max(), options.threshold)) {
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc % 2 == 0) {
+        usage();
+        return 1;
+    }
+
+    vector<SizeClass> sizes(3);
+    sizes[0].name = "small";
+    sizes[0].options.depth = 3;
+    sizes[0].count = 256;
+    sizes[1].name = "medium";
+    sizes[1].options.depth = 6;
+    sizes[1].count = 64;
+    sizes[2].name = "large";
+    sizes[2].options.depth = 9;
+    sizes[2].options.leafPercent = 5;
+    sizes[2].count = 8;
+
+    vector<Result> results;
+
+    for (const SizeClass& sizeClass : sizes) {
+        vector<Result> sizeResults = runSize(sizeClass, options);
+        results.insert(results.end(), sizeResults.begin(), sizeResults.end());
+    }
+
+    string json = toJson(results, options);
+
+    if (options.json.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream(options.json) << json;
+    }
+
+    if (! options.baseline.empty() && ! compare(results, options)) {
+        return 2;
+    }
+
+    return 0;
+}
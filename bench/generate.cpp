@@ -0,0 +1,79 @@
+#include "generate.h"
+
+using std::string;
+
+Generator::Generator(const GeneratorOptions& options, unsigned long long seed) : options(options), state(seed) {
+}
+
+// splitmix64, so sequences don't depend on the standard library's distributions
+unsigned int Generator::random(unsigned int bound) {
+    state += 0x9e3779b97f4a7c15ULL;
+    unsigned long long z = state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return (z ^ (z >> 31)) % bound;
+}
+
+string Generator::next() {
+    string out;
+    expression(options.depth, out);
+
+    return out;
+}
+
+void Generator::expression(unsigned int depth, string& out) {
+    if (depth == 0 || random(100) < options.leafPercent) {
+        if (random(2) == 0 && ! options.variables.empty()) {
+            out += options.variables[random(options.variables.length())];
+        } else {
+            out += std::to_string(1 + random(9));
+        }
+        return;
+    }
+
+    if (random(100) < options.negatePercent) {
+        out += "-";
+    }
+
+    if (options.functions.length() >= 3 && random(100) < options.functionPercent) {
+        out += options.functions.substr(3 * random(options.functions.length() / 3), 3);
+        out += "(";
+        expression(depth - 1, out);
+        out += ")";
+        return;
+    }
+
+    unsigned int total = 0;
+
+    for (unsigned int weight : options.weights) {
+        total += weight;
+    }
+
+    unsigned int pick = random(total);
+    unsigned int op = 0;
+
+    while (pick >= options.weights[op]) {
+        pick -= options.weights[op++];
+    }
+
+    out += "(";
+
+    if (op == 3 || op == 4) {
+        out += "(";
+        expression(depth - 1, out);
+        out += op == 3 ? ")/" + std::to_string(1 + random(9)) : ")^" + std::to_string(2 + random(3));
+    } else {
+        unsigned int operands = 2 + random(options.width > 1 ? options.width - 1 : 1);
+
+        for (unsigned int i = 0; i < operands; ++i) {
+            if (i > 0) {
+                out += "+-*"[op];
+            }
+
+            expression(depth - 1, out);
+        }
+    }
+
+    out += ")";
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+struct GeneratorOptions {
+    unsigned int depth = 4; // nesting levels below the root
+    unsigned int width = 3; // most operands joined by one +, - or * chain
+    unsigned int leafPercent = 15; // chance of stopping early at each level
+    unsigned int functionPercent = 15; // chance of sin/cos/exp/log at each level
+    unsigned int negatePercent = 5; // chance of a unary minus at each level
+    unsigned int weights[5] = {4, 3, 4, 1, 1}; // relative frequency of + - * / ^
+    std::string functions = "sincosexplog"; // three letter names, concatenated
+    std::string variables = "xyz";
+};
+
+/*
+Random expressions for benchmarking. The same seed and options always give the
+same text, independent of the platform.
+Divisors are nonzero literals and exponents small literals, so every expression
+can be evaluated with integers and differentiated with the power rule.
+*/
+class Generator {
+public:
+    Generator(const GeneratorOptions& options, unsigned long long seed);
+
+    std::string next();
+
+private:
+    unsigned int random(unsigned int bound);
+
+    void expression(unsigned int depth, std::string& out);
+
+    GeneratorOptions options;
+    unsigned long long state;
+};
@@ -0,0 +1,519 @@
+#include "bytecode.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+using std::string;
+using std::vector;
+
+// OpCode mirrors the order of NodeType so lowering is a cast
+static_assert(static_cast<int>(OpCode::Exponent) == static_cast<int>(NodeType::Exponent));
+
+namespace {
+
+const unsigned int maxStackRegisters = 256;
+const unsigned int maxStackSymbols = 256;
+const unsigned int blockSize = 256; // rows per batch block, keeps the registers in L1
+
+#if defined(__GNUC__)
+// 32 bytes per operation, four doubles or eight floats, lowered to AVX or pairs of SSE2 instructions depending on the target
+template <typename T>
+struct LaneOf {
+    typedef T type __attribute__((vector_size(32)));
+};
+#else
+template <typename T>
+struct LaneOf {
+    typedef T type;
+};
+#endif
+
+template <typename T>
+using Lane = typename LaneOf<T>::type;
+
+template <typename T>
+const unsigned int laneCount = blockSize * sizeof(T) / sizeof(Lane<T>);
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CAS_VECTOR_MATH 1
+
+// sin, cos, exp and log four doubles at a time, on CPUs with AVX2 and FMA. Each is within an ulp of libm, two for
+// sin/cos near the end of their range, and lanes outside the range a function reduces its argument over are handed to
+// libm. Two doubles at a time with SSE2 are no faster than libm, and neither is widening floats.
+typedef double Doubles __attribute__((vector_size(32)));
+typedef int64_t Bits __attribute__((vector_size(32)));
+
+const double roundingShift = 0x1.8p52; // adding it rounds a double below 2^51 to an integer, which lands in the low bits
+const int64_t roundingShiftBits = 0x4338000000000000;
+const double ln2High = 0x1.62e42feep-1; // ln 2 split so that multiples of the high part are exact
+const double ln2Low = 0x1.a39ef35793c76p-33;
+
+// lanes not set in inside get function's value instead
+[[gnu::target("avx2,fma")]] Doubles patch(Doubles result, Doubles x, Bits inside, double (*function)(double)) {
+    for (int i = 0; i < 4; ++i) {
+        if (! inside[i]) {
+            result[i] = function(x[i]);
+        }
+    }
+
+    return result;
+}
+
+// x = k ln2 + r with |r| <= ln2 / 2, so exp(x) = 2^k exp(r), which a Taylor series gets to well under an ulp
+[[gnu::target("avx2,fma")]] Doubles exponential(Doubles x) {
+    Bits inside = (x >= -708.0) & (x <= 709.0); // 2^k stays a normal double
+    Doubles shifted = x * 0x1.71547652b82fep0 + roundingShift;
+    Doubles k = shifted - roundingShift;
+    Doubles r = x - k * ln2High - k * ln2Low;
+    Doubles p = 1.0 / 6227020800 * r + 1.0 / 479001600;
+    p = p * r + 1.0 / 39916800;
+    p = p * r + 1.0 / 3628800;
+    p = p * r + 1.0 / 362880;
+    p = p * r + 1.0 / 40320;
+    p = p * r + 1.0 / 5040;
+    p = p * r + 1.0 / 720;
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    p = p * r + 1;
+    p = p * r + 1;
+    Bits scale = ((Bits)shifted - roundingShiftBits + 1023) << 52;
+
+    return patch(p * (Doubles)scale, x, inside, exp);
+}
+
+// x = 2^k m with m within a factor of sqrt 2 of 1, and log(m) = 2 atanh(s) with s = (m - 1) / (m + 1), as in fdlibm
+[[gnu::target("avx2,fma")]] Doubles logarithm(Doubles x) {
+    Bits inside = (x >= 0x1p-1022) & (x <= 0x1.fffffffffffffp1023); // not zero, negative, subnormal, infinite or NaN
+    Bits bits = (Bits)x;
+    Doubles m = (Doubles)((bits & 0xfffffffffffff) | 0x3ff0000000000000);
+    Bits halve = m > M_SQRT2;
+    m = halve ? m * 0.5 : m;
+    Doubles k = __builtin_convertvector((bits >> 52) - 1023 - halve, Doubles);
+    Doubles f = m - 1;
+    Doubles s = f / (2 + f);
+    Doubles z = s * s;
+    Doubles w = z * z;
+    Doubles odd = w * (0x1.999999997fa04p-2 + w * (0x1.c71c51d8e78afp-3 + w * 0x1.39a09d078c69fp-3));
+    Doubles even = z * (0x1.5555555555593p-1 + w * (0x1.2492494229359p-2 + w * (0x1.7466496cb03dep-3 + w * 0x1.2f112df3e5244p-3)));
+    Doubles half = 0.5 * f * f;
+    Doubles result = k * ln2High - ((half - (s * (half + odd + even) + k * ln2Low)) - f);
+
+    return patch(result, x, inside, log);
+}
+
+// x = n pi/2 + r with |r| <= pi/4, reduced with pi/2 in three parts whose multiples are exact for |n| < 2^20;
+// the low two bits of n, plus one for cos, say which of sin r, cos r, -sin r and -cos r is the result
+[[gnu::target("avx2,fma")]] Doubles sinCos(Doubles x, int64_t quarterTurns, double (*function)(double)) {
+    Doubles size = (Doubles)((Bits)x & 0x7fffffffffffffff);
+    Doubles shifted = x * 0x1.45f306dc9c883p-1 + roundingShift;
+    Doubles n = shifted - roundingShift;
+    Doubles r = x - n * 0x1.921fb544p0;
+    r = r - n * 0x1.0b4611a6p-34;
+    r = r - n * 0x1.3198a2e037073p-69;
+    Bits quadrant = (Bits)shifted - roundingShiftBits + quarterTurns;
+
+    // fdlibm's kernels
+    Doubles z = r * r;
+    Doubles sine = r + z * r * (-0x1.5555555555549p-3 + z * (0x1.111111110f8a6p-7 + z * (-0x1.a01a019c161d5p-13
+                   + z * (0x1.71de357b1fe7dp-19 + z * (-0x1.ae5e68a2b9cebp-26 + z * 0x1.5d93a5acfd57cp-33)))));
+    Doubles tail = z * z * (0x1.555555555554cp-5 + z * (-0x1.6c16c16c15177p-10 + z * (0x1.a01a019cb159p-16
+                   + z * (-0x1.27e4f809c52adp-22 + z * (0x1.1ee9ebdb4b1c4p-29 + z * -0x1.8fae9be8838d4p-37)))));
+    Doubles w = 1 - 0.5 * z;
+    Doubles cosine = w + (((1 - w) - 0.5 * z) + tail);
+
+    Doubles result = (quadrant & 1) != 0 ? cosine : sine;
+    result = (quadrant & 2) != 0 ? -result : result;
+
+    if (quarterTurns == 0) {
+        result = size < 0x1p-26 ? x : result; // keeps the sign of -0
+    }
+
+    return patch(result, x, size <= 0x1p16, function);
+}
+
+template <OpCode op>
+[[gnu::target("avx2,fma")]] Doubles vectorMath(Doubles x) {
+    switch (op) {
+        case OpCode::Sin: return sinCos(x, 0, sin);
+        case OpCode::Cos: return sinCos(x, 1, cos);
+        case OpCode::Exp: return exponential(x);
+        default: return logarithm(x);
+    }
+}
+
+// rows rounded up to whole vectors, which the registers have room for
+template <OpCode op>
+[[gnu::target("avx2,fma")]] void mapVector(const double* in, double* out, unsigned int rows) {
+    for (unsigned int i = 0; i < rows; i += 4) {
+        Doubles v;
+        std::memcpy(&v, in + i, sizeof(v));
+        v = vectorMath<op>(v);
+        std::memcpy(out + i, &v, sizeof(v));
+    }
+}
+
+bool hasVectorMath() {
+    static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+    return supported;
+}
+#endif
+
+// applies sin, cos, exp or log to the first rows values of a register
+template <OpCode op, typename T>
+void mapFunction(const T* in, T* out, unsigned int rows) {
+#ifdef CAS_VECTOR_MATH
+    if constexpr (std::is_same_v<T, double>) {
+        if (hasVectorMath()) {
+            mapVector<op>(in, out, rows);
+            return;
+        }
+    }
+#endif
+
+    for (unsigned int i = 0; i < rows; ++i) {
+        switch (op) {
+            case OpCode::Sin: out[i] = std::sin(in[i]); break;
+            case OpCode::Cos: out[i] = std::cos(in[i]); break;
+            case OpCode::Exp: out[i] = std::exp(in[i]); break;
+            default: out[i] = std::log(in[i]); break;
+        }
+    }
+}
+
+const char* opName(OpCode op) {
+    switch (op) {
+        case OpCode::LoadVal: return "loadval";
+        case OpCode::LoadVar: return "loadvar";
+        case OpCode::Negate: return "neg";
+        case OpCode::Sin: return "sin";
+        case OpCode::Cos: return "cos";
+        case OpCode::Exp: return "exp";
+        case OpCode::Log: return "log";
+        case OpCode::Add: return "add";
+        case OpCode::Subtract: return "sub";
+        case OpCode::Multiply: return "mul";
+        case OpCode::Divide: return "div";
+        case OpCode::Exponent: return "pow";
+        default: return "halt";
+    }
+}
+
+// operator semantics match NodeBase::evaluate()
+void run(const Instruction* ip, int* regs, const int* vars) {
+#if defined(__GNUC__)
+    static const void* labels[] = {&&loadVal, &&loadVar, &&negate, &&sine, &&cosine, &&expo, &&logarithm,
+                                   &&add, &&subtract, &&multiply, &&divide, &&exponent, &&halt};
+
+#define DISPATCH() goto *labels[static_cast<int>(ip->op)]
+#define NEXT() ++ip; DISPATCH()
+
+    DISPATCH();
+
+loadVal:
+    regs[ip->dest] = static_cast<int>(ip->a);
+    NEXT();
+loadVar:
+    regs[ip->dest] = vars[ip->a];
+    NEXT();
+negate:
+    regs[ip->dest] = -1 * regs[ip->a];
+    NEXT();
+sine:
+    regs[ip->dest] = sin(regs[ip->a]);
+    NEXT();
+cosine:
+    regs[ip->dest] = cos(regs[ip->a]);
+    NEXT();
+expo:
+    regs[ip->dest] = exp(regs[ip->a]);
+    NEXT();
+logarithm:
+    regs[ip->dest] = log(regs[ip->a]);
+    NEXT();
+add:
+    regs[ip->dest] = regs[ip->a] + regs[ip->b];
+    NEXT();
+subtract:
+    regs[ip->dest] = regs[ip->a] - regs[ip->b];
+    NEXT();
+multiply:
+    regs[ip->dest] = regs[ip->a] * regs[ip->b];
+    NEXT();
+divide:
+    regs[ip->dest] = regs[ip->a] / regs[ip->b];
+    NEXT();
+exponent:
+    regs[ip->dest] = pow(regs[ip->a], regs[ip->b]);
+    NEXT();
+halt:
+    return;
+
+#undef NEXT
+#undef DISPATCH
+#else
+    for (;; ++ip) {
+        switch (ip->op) {
+            case OpCode::LoadVal: regs[ip->dest] = static_cast<int>(ip->a); break;
+            case OpCode::LoadVar: regs[ip->dest] = vars[ip->a]; break;
+            case OpCode::Negate: regs[ip->dest] = -1 * regs[ip->a]; break;
+            case OpCode::Sin: regs[ip->dest] = sin(regs[ip->a]); break;
+            case OpCode::Cos: regs[ip->dest] = cos(regs[ip->a]); break;
+            case OpCode::Exp: regs[ip->dest] = exp(regs[ip->a]); break;
+            case OpCode::Log: regs[ip->dest] = log(regs[ip->a]); break;
+            case OpCode::Add: regs[ip->dest] = regs[ip->a] + regs[ip->b]; break;
+            case OpCode::Subtract: regs[ip->dest] = regs[ip->a] - regs[ip->b]; break;
+            case OpCode::Multiply: regs[ip->dest] = regs[ip->a] * regs[ip->b]; break;
+            case OpCode::Divide: regs[ip->dest] = regs[ip->a] / regs[ip->b]; break;
+            case OpCode::Exponent: regs[ip->dest] = pow(regs[ip->a], regs[ip->b]); break;
+            case OpCode::Halt: return;
+        }
+    }
+#endif
+}
+
+// evaluates one block of rows, each register holds blockSize values
+template <typename T>
+void runBatch(const vector<Instruction>& code, const T* const* columns, unsigned int start, unsigned int rows, Lane<T>* regs) {
+    for (const Instruction& instruction : code) {
+        Lane<T>* d = regs + instruction.dest * laneCount<T>;
+        const Lane<T>* a = regs + instruction.a * laneCount<T>;
+        const Lane<T>* b = regs + instruction.b * laneCount<T>;
+        T* ds = reinterpret_cast<T*>(d);
+        const T* as = reinterpret_cast<const T*>(a);
+
+        switch (instruction.op) {
+            case OpCode::LoadVal: {
+                Lane<T> val = Lane<T>{} + static_cast<T>(static_cast<int>(instruction.a));
+                for (unsigned int i = 0; i < laneCount<T>; ++i) d[i] = val;
+                break;
+            }
+            case OpCode::LoadVar: {
+                const T* column = columns[instruction.a];
+                for (unsigned int i = 0; i < blockSize; ++i) ds[i] = column != nullptr && i < rows ? column[start + i] : 0;
+                break;
+            }
+            case OpCode::Negate: for (unsigned int i = 0; i < laneCount<T>; ++i) d[i] = -a[i]; break;
+            case OpCode::Sin: mapFunction<OpCode::Sin>(as, ds, rows); break;
+            case OpCode::Cos: mapFunction<OpCode::Cos>(as, ds, rows); break;
+            case OpCode::Exp: mapFunction<OpCode::Exp>(as, ds, rows); break;
+            case OpCode::Log: mapFunction<OpCode::Log>(as, ds, rows); break;
+            case OpCode::Add: for (unsigned int i = 0; i < laneCount<T>; ++i) d[i] = a[i] + b[i]; break;
+            case OpCode::Subtract: for (unsigned int i = 0; i < laneCount<T>; ++i) d[i] = a[i] - b[i]; break;
+            case OpCode::Multiply: for (unsigned int i = 0; i < laneCount<T>; ++i) d[i] = a[i] * b[i]; break;
+            case OpCode::Divide: for (unsigned int i = 0; i < laneCount<T>; ++i) d[i] = a[i] / b[i]; break;
+            case OpCode::Exponent: {
+                const T* bs = reinterpret_cast<const T*>(b);
+                for (unsigned int i = 0; i < rows; ++i) ds[i] = std::pow(as[i], bs[i]);
+                break;
+            }
+            case OpCode::Halt: return;
+        }
+    }
+}
+
+}
+
+Program::Program()
+    : code{Instruction{OpCode::LoadVal, 0, 0, 0}, Instruction{OpCode::Halt, 0, 0, 0}}, registers(1), result(0), symbolBound(0) {
+}
+
+Program Program::compile(const NodeBase& node) {
+    return compile(FlatTree::fromTree(node));
+}
+
+Program Program::compile(const FlatTree& tree) {
+    Program program;
+
+    if (tree.empty()) {
+        return program;
+    }
+
+    unsigned int root = tree.getRoot();
+    vector<bool> used = tree.reachable(root);
+
+    // index of the last node reading each value; the root is read by the caller
+    const unsigned int never = std::numeric_limits<unsigned int>::max();
+    vector<unsigned int> lastUse(root + 1, 0);
+    lastUse[root] = never;
+
+    for (unsigned int i = 0; i <= root; ++i) {
+        if (! used[i] || tree.getType(i) == NodeType::Val || tree.getType(i) == NodeType::Var) {
+            continue;
+        }
+
+        lastUse[tree.getLeft(i)] = i;
+
+        if (tree.getType(i) >= NodeType::Add) {
+            lastUse[tree.getRight(i)] = i;
+        }
+    }
+
+    program.code.clear();
+    program.registers = 0;
+
+    vector<unsigned int> reg(root + 1);
+    vector<unsigned int> freeRegs;
+
+    auto release = [&](unsigned int node, unsigned int i) {
+        if (lastUse[node] == i) {
+            freeRegs.push_back(reg[node]);
+            lastUse[node] = never; // a node used twice by i is released once
+        }
+    };
+
+    for (unsigned int i = 0; i <= root; ++i) {
+        if (! used[i]) {
+            continue;
+        }
+
+        NodeType type = tree.getType(i);
+        Instruction instruction{static_cast<OpCode>(type), 0, 0, 0};
+
+        if (type == NodeType::Val) {
+            instruction.a = static_cast<unsigned int>(tree.getVal(i));
+        } else if (type == NodeType::Var) {
+            instruction.a = tree.getSymbol(i);
+            program.symbolBound = std::max(program.symbolBound, instruction.a + 1);
+        } else {
+            instruction.a = reg[tree.getLeft(i)];
+            release(tree.getLeft(i), i);
+
+            if (type >= NodeType::Add) {
+                instruction.b = reg[tree.getRight(i)];
+                release(tree.getRight(i), i);
+            }
+        }
+
+        // operands are read before dest is written, so dest may reuse an operand's register
+        if (freeRegs.empty()) {
+            reg[i] = program.registers++;
+        } else {
+            reg[i] = freeRegs.back();
+            freeRegs.pop_back();
+        }
+
+        instruction.dest = reg[i];
+        program.code.push_back(instruction);
+    }
+
+    program.code.push_back(Instruction{OpCode::Halt, 0, 0, 0});
+    program.result = reg[root];
+
+    return program;
+}
+
+int Program::evaluate(const Bindings& bindings) const {
+    if (bindings.size() >= symbolBound) {
+        return evaluate(bindings.data());
+    }
+
+    // symbols past the end of bindings read as 0
+    if (symbolBound <= maxStackSymbols) {
+        int vars[maxStackSymbols] = {};
+        std::copy(bindings.data(), bindings.data() + bindings.size(), vars);
+
+        return evaluate(vars);
+    }
+
+    vector<int> vars(symbolBound, 0);
+    std::copy(bindings.data(), bindings.data() + bindings.size(), vars.begin());
+
+    return evaluate(vars.data());
+}
+
+int Program::evaluate(const int* vars) const {
+    if (registers <= maxStackRegisters) {
+        int regs[maxStackRegisters];
+        run(code.data(), regs, vars);
+
+        return regs[result];
+    }
+
+    vector<int> regs(registers);
+    run(code.data(), regs.data(), vars);
+
+    return regs[result];
+}
+
+void Program::evaluate(const Columns& columns, unsigned int rows, double* out) const {
+    evaluateBatch(columns, rows, out);
+}
+
+void Program::evaluate(const ColumnsOf<float>& columns, unsigned int rows, float* out) const {
+    evaluateBatch(columns, rows, out);
+}
+
+unsigned int Program::size() const {
+    return code.size() - 1;
+}
+
+unsigned int Program::getRegisterCount() const {
+    return registers;
+}
+
+unsigned int Program::getSymbolBound() const {
+    return symbolBound;
+}
+
+const vector<Instruction>& Program::getCode() const {
+    return code;
+}
+
+unsigned int Program::getResult() const {
+    return result;
+}
+
+template <typename T>
+void Program::evaluateBatch(const ColumnsOf<T>& columns, unsigned int rows, T* out) const {
+    vector<const T*> vars(symbolBound, nullptr);
+
+    for (Symbol symbol = 0; symbol < symbolBound; ++symbol) {
+        vars[symbol] = columns[symbol];
+    }
+
+    vector<Lane<T>> regs(registers * laneCount<T>);
+    const T* resultReg = reinterpret_cast<const T*>(regs.data() + result * laneCount<T>);
+
+    for (unsigned int start = 0; start < rows; start += blockSize) {
+        unsigned int count = std::min(blockSize, rows - start);
+        runBatch(code, vars.data(), start, count, regs.data());
+        std::copy(resultReg, resultReg + count, out + start);
+    }
+}
+
+string Program::toString() const {
+    string out;
+
+    for (const Instruction& instruction : code) {
+        out += opName(instruction.op);
+
+        if (instruction.op == OpCode::Halt) {
+            out += " r" + std::to_string(result) + "\n";
+            break;
+        }
+
+        out += " r" + std::to_string(instruction.dest) + ", ";
+
+        if (instruction.op == OpCode::LoadVal) {
+            out += std::to_string(static_cast<int>(instruction.a));
+        } else if (instruction.op == OpCode::LoadVar) {
+            out += symbolName(instruction.a);
+        } else {
+            out += "r" + std::to_string(instruction.a);
+
+            if (instruction.op >= OpCode::Add) {
+                out += ", r" + std::to_string(instruction.b);
+            }
+        }
+
+        out += "\n";
+    }
+
+    return out;
+}
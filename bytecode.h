@@ -0,0 +1,74 @@
+#pragma once
+
+#include "flat.h"
+
+#include <string>
+#include <vector>
+
+/*
+Register bytecode for repeated evaluation.
+Compiling from a hash-consed FlatTree means every common subexpression is
+computed once; registers are reused as soon as the last reader of a value
+has executed.
+
+Batch evaluation runs each instruction over a block of rows at a time in
+double or single precision, with the arithmetic operators vectorized; a float
+operation covers twice as many rows as a double one. In double, sin, cos,
+exp and log are vectorized too where the CPU has AVX2 and FMA, to within an
+ulp or two of libm; otherwise, and for pow, each row calls libm. Like every
+evaluator, the integer ones included, it takes sin/cos arguments in radians.
+*/
+
+// one column of values per variable symbol
+template <typename T>
+using ColumnsOf = SymbolValues<const T*>;
+
+using Columns = ColumnsOf<double>;
+
+enum class OpCode : unsigned char {LoadVal, LoadVar, Negate, Sin, Cos, Exp, Log, Add, Subtract, Multiply, Divide, Exponent, Halt};
+
+struct Instruction {
+    OpCode op;
+    unsigned int dest; // register
+    unsigned int a; // register, or the constant / symbol for LoadVal / LoadVar
+    unsigned int b; // register
+};
+
+class Program {
+public:
+    Program();
+
+    static Program compile(const FlatTree& tree);
+
+    static Program compile(const NodeBase& node);
+
+    int evaluate(const Bindings& bindings = {}) const;
+
+    int evaluate(const int* vars) const; // vars is indexed by symbol, getSymbolBound() entries
+
+    // one column of rows values per variable symbol, unbound symbols read as 0
+    void evaluate(const Columns& columns, unsigned int rows, double* out) const;
+
+    void evaluate(const ColumnsOf<float>& columns, unsigned int rows, float* out) const; // twice the values per operation
+
+    unsigned int size() const; // instructions, excluding Halt
+
+    unsigned int getRegisterCount() const;
+
+    unsigned int getSymbolBound() const; // one past the largest symbol read
+
+    const std::vector<Instruction>& getCode() const; // ends with Halt
+
+    unsigned int getResult() const; // register holding the value once Halt is reached
+
+    std::string toString() const; // disassembly, one instruction per line
+
+private:
+    template <typename T>
+    void evaluateBatch(const ColumnsOf<T>& columns, unsigned int rows, T* out) const;
+
+    std::vector<Instruction> code;
+    unsigned int registers;
+    unsigned int result;
+    unsigned int symbolBound;
+};
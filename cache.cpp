@@ -0,0 +1,114 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <vector>
+
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+size_t countNodes(const NodeBase& node) {
+    size_t count = 0;
+    vector<const NodeBase*> stack{&node};
+
+    while (! stack.empty()) {
+        const NodeBase* next = stack.back();
+        stack.pop_back();
+        ++count;
+
+        if (next->getType() >= NodeType::Add) {
+            stack.push_back(&static_cast<const BinaryNodeBase*>(next)->getLeft());
+            stack.push_back(&static_cast<const BinaryNodeBase*>(next)->getRight());
+        } else if (next->getType() != NodeType::Val && next->getType() != NodeType::Var) {
+            stack.push_back(&static_cast<const UnaryNodeBase*>(next)->getArg());
+        }
+    }
+
+    return count;
+}
+
+}
+
+TreeCache::TreeCache(size_t capacity)
+    : shardCapacity(std::max<size_t>(1, capacity / shardCount)), hits(0), misses(0) {
+}
+
+size_t TreeCache::hash(const NodeBase& key, unsigned int tag) {
+    return key.hash() ^ tag * 0x9e3779b97f4a7c15ULL;
+}
+
+unique_ptr<NodeBase> TreeCache::find(const NodeBase& key, unsigned int tag) {
+    return find(key, tag, hash(key, tag));
+}
+
+unique_ptr<NodeBase> TreeCache::find(const NodeBase& key, unsigned int tag, size_t hash) {
+    Entry entry;
+    Shard& s = shard(hash);
+
+    // the entry's trees are shared, so comparing and copying happen after releasing the lock
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.entries.find(hash);
+
+        if (it != s.entries.end()) {
+            entry = it->second;
+        }
+    }
+
+    if (entry.key == nullptr || entry.tag != tag || ! entry.key->equals(key)) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    hits.fetch_add(1, std::memory_order_relaxed);
+
+    return entry.result->clone();
+}
+
+void TreeCache::insert(const NodeBase& key, unsigned int tag, const NodeBase& result) {
+    insert(key, tag, hash(key, tag), result);
+}
+
+void TreeCache::insert(const NodeBase& key, unsigned int tag, size_t hash, const NodeBase& result) {
+    size_t weight = (countNodes(key) + countNodes(result) + entryNodes - 1) / entryNodes;
+
+    if (weight > shardCapacity) {
+        return;
+    }
+
+    // trees are copied before taking the lock and replaced entries are freed after releasing it
+    Entry entry{tag, weight, key.clone(), result.clone()};
+    vector<Entry> old;
+    Shard& s = shard(hash);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto [it, inserted] = s.entries.try_emplace(hash);
+    s.weight += weight - it->second.weight;
+    old.push_back(std::move(it->second));
+    it->second = std::move(entry);
+
+    if (inserted) {
+        s.order.push_back(hash);
+    }
+
+    while (s.weight > shardCapacity) {
+        auto oldest = s.entries.find(s.order.front());
+        s.order.pop_front();
+        s.weight -= oldest->second.weight;
+        old.push_back(std::move(oldest->second));
+        s.entries.erase(oldest);
+    }
+}
+
+size_t TreeCache::getHits() const {
+    return hits.load(std::memory_order_relaxed);
+}
+
+size_t TreeCache::getMisses() const {
+    return misses.load(std::memory_order_relaxed);
+}
+
+TreeCache::Shard& TreeCache::shard(size_t hash) {
+    // the low bits pick the bucket inside a shard, so shards use the high bits
+    return shards[(hash >> 58) % shardCount];
+}
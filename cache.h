@@ -0,0 +1,74 @@
+#pragma once
+
+#include "tree.h"
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/*
+Bounded cache of results computed from trees, shared between threads.
+An entry maps a tree and a tag (the variable a derivative is taken with
+respect to, or a value no symbol reaches for the canonical form of a
+polynomial) to a result tree. Keys are found by
+structural hash and compared structurally, so a hash collision is a miss
+rather than a wrong answer.
+Entries are spread over shards by hash and each shard has its own lock, so
+threads rarely wait on each other and never on a lock held for the whole
+cache. A lock is held only to look up, add or drop a map entry; hashing,
+comparing and copying trees happen outside it, on trees shared by
+shared_ptr, so two threads meet on a lock only if they reach one of the
+shards in the same few hundred nanoseconds. A lock-free table would also
+need its own reclamation of the trees that readers still hold, which is
+what shared_ptr provides here. A full shard drops its oldest entries.
+Capacity counts entries of up to entryNodes nodes, key and result together;
+a larger entry counts as one per entryNodes, so the memory held is bounded
+however large the trees are, and an entry larger than a shard isn't kept.
+*/
+
+class TreeCache {
+public:
+    TreeCache(size_t capacity);
+
+    static size_t hash(const NodeBase& key, unsigned int tag); // for the overloads taking it, so a miss and its insert hash once
+
+    std::unique_ptr<NodeBase> find(const NodeBase& key, unsigned int tag); // a copy of the result, null on a miss
+
+    std::unique_ptr<NodeBase> find(const NodeBase& key, unsigned int tag, size_t hash);
+
+    void insert(const NodeBase& key, unsigned int tag, const NodeBase& result);
+
+    void insert(const NodeBase& key, unsigned int tag, size_t hash, const NodeBase& result);
+
+    size_t getHits() const;
+
+    size_t getMisses() const;
+
+private:
+    struct Entry {
+        unsigned int tag = 0;
+        size_t weight = 0; // toward the capacity, see above
+        std::shared_ptr<const NodeBase> key;
+        std::shared_ptr<const NodeBase> result;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<size_t, Entry> entries; // by hash of key and tag
+        std::deque<size_t> order; // hashes in insertion order
+        size_t weight = 0; // of every entry
+    };
+
+    static const size_t shardCount = 64;
+    static const size_t entryNodes = 64;
+
+    Shard& shard(size_t hash);
+
+    size_t shardCapacity;
+    std::array<Shard, shardCount> shards;
+    std::atomic<size_t> hits;
+    std::atomic<size_t> misses;
+};
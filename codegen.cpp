@@ -0,0 +1,416 @@
+#include "codegen.h"
+#include "stack.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// one node of the DAG; operands are earlier entries
+struct Op {
+    NodeType type;
+    unsigned int left;
+    unsigned int right;
+    Symbol symbol; // NodeType::Var
+    double val; // NodeType::Val
+
+    bool operator==(const Op& other) const {
+        return type == other.type && left == other.left && right == other.right && symbol == other.symbol
+               && std::memcmp(&val, &other.val, sizeof(val)) == 0;
+    }
+};
+
+struct OpHash {
+    size_t operator()(const Op& op) const {
+        uint64_t bits;
+        std::memcpy(&bits, &op.val, sizeof(bits));
+        size_t h = static_cast<size_t>(op.type);
+
+        for (uint64_t part : {static_cast<uint64_t>(op.left), static_cast<uint64_t>(op.right), static_cast<uint64_t>(op.symbol), bits}) {
+            h = (h ^ part) * 0x100000001b3ULL;
+        }
+
+        return h;
+    }
+};
+
+bool isUnary(NodeType type) {
+    return type != NodeType::Val && type != NodeType::Var && type < NodeType::Add;
+}
+
+double fold(NodeType type, double l, double r) {
+    switch (type) {
+        case NodeType::AddInverse: return -l;
+        case NodeType::Sin: return std::sin(l);
+        case NodeType::Cos: return std::cos(l);
+        case NodeType::Exp: return std::exp(l);
+        case NodeType::Log: return std::log(l);
+        case NodeType::Add: return l + r;
+        case NodeType::Subtract: return l - r;
+        case NodeType::Multiply: return l * r;
+        case NodeType::Divide: return l / r;
+        default: return std::pow(l, r);
+    }
+}
+
+// a power written as multiplications, or 0
+int smallPower(double exponent) {
+    return exponent == 2 || exponent == 3 || exponent == 4 ? static_cast<int>(exponent) : 0;
+}
+
+class Dag {
+public:
+    unsigned int add(const NodeBase& node) {
+        checkStack();
+        NodeType type = node.getType();
+        Op op{type, 0, 0, 0, 0};
+
+        if (type == NodeType::Val) {
+            op.val = static_cast<const NodeVal&>(node).val;
+        } else if (type == NodeType::Var) {
+            op.symbol = static_cast<const NodeVar&>(node).symbol;
+        } else if (isUnary(type)) {
+            op.left = add(static_cast<const UnaryNodeBase&>(node).getArg());
+
+            if (ops[op.left].type == NodeType::Val) {
+                op = Op{NodeType::Val, 0, 0, 0, fold(type, ops[op.left].val, 0)};
+            }
+        } else {
+            const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+            op.left = add(binary.getLeft());
+            op.right = add(binary.getRight());
+
+            if (ops[op.left].type == NodeType::Val && ops[op.right].type == NodeType::Val) {
+                op = Op{NodeType::Val, 0, 0, 0, fold(type, ops[op.left].val, ops[op.right].val)};
+            }
+        }
+
+        auto [it, inserted] = ids.try_emplace(op, ops.size());
+
+        if (inserted) {
+            ops.push_back(op);
+        }
+
+        return it->second;
+    }
+
+    vector<Op> ops;
+
+private:
+    std::unordered_map<Op, unsigned int, OpHash> ids;
+};
+
+// C and C++ keywords, alternative tokens and the names <math.h> and <stddef.h> define, besides those reserved below
+const char* keywords[] = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char",
+    "char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const", "const_cast", "consteval", "constexpr",
+    "constinit", "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete", "do", "double",
+    "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if",
+    "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+    "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "requires", "restrict", "return", "short",
+    "signed", "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local",
+    "throw", "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+    "wchar_t", "while", "xor", "xor_eq",
+    "i", "n", "out", "sin", "cos", "exp", "log", "pow", "sqrt", "fabs", "NAN", "INFINITY", "HUGE_VAL", "HUGE_VALF",
+    "HUGE_VALL", "MATH_ERRNO", "MATH_ERREXCEPT", "math_errhandling", "float_t", "double_t", "NULL", "size_t", "ptrdiff_t",
+    "max_align_t", "offsetof"
+};
+
+// names <math.h> may define as macros, and identifiers C and C++ reserve for the implementation
+bool reservedPrefix(const string& name) {
+    return name.substr(0, 2) == "M_" || name.substr(0, 3) == "FP_" || (name.size() > 1 && name[0] == '_' && (name[1] == '_' || isupper(name[1])));
+}
+
+// t0, t1, ... and out0, out1, ... name temporaries and outputs
+bool generatedName(const string& name) {
+    size_t digits = name[0] == 't' ? 1 : name.substr(0, 3) == "out" ? 3 : name.size();
+    return name.size() > digits && std::all_of(name.begin() + digits, name.end(), isdigit);
+}
+
+class Emitter {
+public:
+    Emitter(const vector<const NodeBase*>& outputs, const CodeOptions& options) : options(options) {
+        for (const NodeBase* output : outputs) {
+            roots.push_back(dag.add(*output));
+        }
+
+        uses.assign(dag.ops.size(), 0);
+        temporary.assign(dag.ops.size(), -1);
+
+        for (unsigned int root : roots) {
+            ++uses[root];
+        }
+
+        // every op is added after its operands, so a backwards pass sees all users of an op before the op
+        vector<bool> live(dag.ops.size(), false);
+
+        for (unsigned int root : roots) {
+            live[root] = true;
+        }
+
+        for (unsigned int i = dag.ops.size(); i-- > 0;) {
+            const Op& op = dag.ops[i];
+
+            if (! live[i] || op.type == NodeType::Val || op.type == NodeType::Var) {
+                continue;
+            }
+
+            live[op.left] = true;
+            ++uses[op.left];
+
+            if (! isUnary(op.type)) {
+                live[op.right] = true;
+                ++uses[op.right];
+
+                // a base multiplied by itself is read more than once
+                if (op.type == NodeType::Exponent && dag.ops[op.right].type == NodeType::Val && smallPower(dag.ops[op.right].val)) {
+                    ++uses[op.left];
+                }
+            }
+        }
+
+        nameVariables(live);
+    }
+
+    void emit(const vector<string>& labels, string& out) {
+        const char* indent = options.loop ? "        " : "    ";
+        bool single = roots.size() == 1;
+        out += "#include <math.h>\n#include <stddef.h>\n\n";
+
+        // restrict is C99, C++ compilers spell it __restrict
+        if (options.loop) {
+            out += "#ifdef __cplusplus\n#define restrict __restrict\n#endif\n\n";
+        }
+
+        if (! labels.empty()) {
+            out += "/* ";
+
+            for (size_t k = 0; k < labels.size(); ++k) {
+                out += k > 0 ? ", " : "";
+                out += single ? (options.loop ? "out" : options.name) : "out" + std::to_string(k);
+                out += " = " + labels[k];
+            }
+
+            out += " */\n";
+        }
+
+        signature(out);
+
+        if (options.loop) {
+            out += "    for (size_t i = 0; i < n; ++i) {\n";
+        }
+
+        for (unsigned int i = 0; i < dag.ops.size(); ++i) {
+            const Op& op = dag.ops[i];
+
+            if (uses[i] < 2 || op.type == NodeType::Val || op.type == NodeType::Var) {
+                continue;
+            }
+
+            out += indent;
+            out += "const double t" + std::to_string(temporaries) + " = ";
+            expression(i, 0, out);
+            out += ";\n";
+            temporary[i] = temporaries++;
+        }
+
+        for (size_t k = 0; k < roots.size(); ++k) {
+            out += indent;
+
+            if (options.loop) {
+                out += single ? "out[i] = " : "out" + std::to_string(k) + "[i] = ";
+            } else {
+                out += single ? "return " : "out[" + std::to_string(k) + "] = ";
+            }
+
+            expression(roots[k], 0, out);
+            out += ";\n";
+        }
+
+        if (options.loop) {
+            out += "    }\n";
+        }
+
+        out += "}\n";
+
+        if (options.loop) {
+            out += "\n#ifdef __cplusplus\n#undef restrict\n#endif\n";
+        }
+    }
+
+private:
+    // parameters are named after the variables, unless that clashes with the generated names or a keyword
+    void nameVariables(const vector<bool>& live) {
+        std::unordered_set<string> taken(std::begin(keywords), std::end(keywords));
+        taken.insert(options.name);
+
+        for (unsigned int i = 0; i < dag.ops.size(); ++i) {
+            if (live[i] && dag.ops[i].type == NodeType::Var && std::find(variables.begin(), variables.end(), dag.ops[i].symbol) == variables.end()) {
+                variables.push_back(dag.ops[i].symbol);
+            }
+        }
+
+        std::sort(variables.begin(), variables.end(), symbolLess);
+
+        for (Symbol symbol : variables) {
+            string name = symbolName(symbol);
+
+            // a suffix can't take a name out of a reserved prefix
+            if (reservedPrefix(name)) {
+                name = "v_" + name;
+            }
+
+            while (taken.count(name) > 0 || generatedName(name)) {
+                name += '_';
+            }
+
+            taken.insert(name);
+            names.slot(symbol) = name;
+        }
+    }
+
+    void signature(string& out) {
+        bool single = roots.size() == 1;
+        out += options.loop || ! single ? "void " : "double ";
+        out += options.name + "(";
+        out += options.loop ? "size_t n" : "";
+        string separator = options.loop ? ", " : "";
+
+        for (Symbol symbol : variables) {
+            out += separator + (options.loop ? "const double* restrict " : "double ") + names[symbol];
+            separator = ", ";
+        }
+
+        if (options.loop) {
+            for (size_t k = 0; k < roots.size(); ++k) {
+                out += separator + "double* restrict " + (single ? "out" : "out" + std::to_string(k));
+            }
+        } else if (! single) {
+            out += separator + "double* out";
+        } else if (variables.empty()) {
+            out += "void";
+        }
+
+        out += ") {\n";
+    }
+
+    static void literal(double val, string& out) {
+        if (std::isnan(val)) {
+            out += "NAN";
+            return;
+        } else if (std::isinf(val)) {
+            out += val < 0 ? "(-INFINITY)" : "INFINITY";
+            return;
+        }
+
+        char digits[32];
+        char* end = std::to_chars(digits, digits + sizeof(digits), val).ptr;
+        string text(digits, end);
+
+        // a double literal, not an int
+        if (text.find_first_of(".e") == string::npos) {
+            text += ".0";
+        }
+
+        out += val < 0 ? "(" + text + ")" : text;
+    }
+
+    // appends op, in parentheses if it is an operator that binds less tightly than minimum:
+    // 1 for + and -, 2 for * and /, so the tree's order of evaluation is kept
+    void expression(unsigned int i, int minimum, string& out) {
+        const Op& op = dag.ops[i];
+
+        if (temporary[i] >= 0) {
+            out += "t" + std::to_string(temporary[i]);
+            return;
+        }
+
+        switch (op.type) {
+            case NodeType::Val:
+                literal(op.val, out);
+                return;
+            case NodeType::Var:
+                out += names[op.symbol];
+                out += options.loop ? "[i]" : "";
+                return;
+            case NodeType::AddInverse: {
+                // a nested negation written inline would read as the -- operator
+                bool nested = dag.ops[op.left].type == NodeType::AddInverse && temporary[op.left] < 0;
+                out += nested ? "-(" : "-";
+                expression(op.left, 3, out);
+                out += nested ? ")" : "";
+                return;
+            }
+            case NodeType::Sin:
+            case NodeType::Cos:
+            case NodeType::Exp:
+            case NodeType::Log:
+                out += op.type == NodeType::Sin ? "sin(" : op.type == NodeType::Cos ? "cos(" : op.type == NodeType::Exp ? "exp(" : "log(";
+                expression(op.left, 0, out);
+                out += ")";
+                return;
+            case NodeType::Exponent: {
+                const Op& exponent = dag.ops[op.right];
+
+                if (exponent.type == NodeType::Val && smallPower(exponent.val)) {
+                    out += minimum > 2 ? "(" : "";
+
+                    for (int k = 0; k < smallPower(exponent.val); ++k) {
+                        out += k > 0 ? "*" : "";
+                        expression(op.left, k > 0 ? 3 : 2, out);
+                    }
+
+                    out += minimum > 2 ? ")" : "";
+                } else {
+                    out += "pow(";
+                    expression(op.left, 0, out);
+                    out += ", ";
+                    expression(op.right, 0, out);
+                    out += ")";
+                }
+                return;
+            }
+            default: {
+                const char* symbol = op.type == NodeType::Add ? " + " : op.type == NodeType::Subtract ? " - " : op.type == NodeType::Multiply ? "*" : "/";
+                int precedence = op.type == NodeType::Add || op.type == NodeType::Subtract ? 1 : 2;
+                out += precedence < minimum ? "(" : "";
+                expression(op.left, precedence, out);
+                out += symbol;
+                expression(op.right, precedence + 1, out);
+                out += precedence < minimum ? ")" : "";
+                return;
+            }
+        }
+    }
+
+    const CodeOptions& options;
+    Dag dag;
+    vector<unsigned int> roots;
+    vector<unsigned int> uses; // by outputs and by live ops
+    vector<int> temporary; // number of the temporary holding an op, -1 if written inline
+    int temporaries = 0;
+    vector<Symbol> variables; // in name order
+    SymbolValues<string> names;
+};
+
+}
+
+bool isFunctionName(const string& name) {
+    // at file scope every name starting with _ is reserved
+    if (name.empty() || isdigit(name[0]) || name[0] == '_' || ! std::all_of(name.begin(), name.end(), [](unsigned char c) { return isalnum(c) || c == '_'; })) {
+        return false;
+    }
+
+    return ! reservedPrefix(name) && ! generatedName(name) && std::find(std::begin(keywords), std::end(keywords), name) == std::end(keywords);
+}
+
+void generateCode(const vector<const NodeBase*>& outputs, const vector<string>& labels, const CodeOptions& options, string& out) {
+    Emitter(outputs, options).emit(labels, out);
+}
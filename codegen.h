@@ -0,0 +1,35 @@
+#pragma once
+
+#include "tree.h"
+
+#include <string>
+#include <vector>
+
+/*
+C source generation for expressions and their derivatives.
+All outputs are merged into one hash-consed DAG, so a subexpression shared
+within or between them is computed once, in a temporary; subexpressions used
+once are written inline. Operations on constants are folded in double
+precision, and small integer powers become multiplications. Like the batch
+evaluator, the code computes in double with sin/cos arguments in radians.
+The result compiles as C99 or C++ and needs only <math.h> and <stddef.h>; in
+C++ the loop form's restrict pointers are spelled __restrict.
+*/
+
+struct CodeOptions {
+    std::string name = "f"; // of the function, see isFunctionName()
+
+    // a loop over n rows reading one array per variable and writing one per output, with restrict
+    // pointers so the compiler may vectorize it; otherwise a function of one value per variable
+    bool loop = false;
+};
+
+// true if name is a C identifier the generated function may take: not a keyword, a name from <math.h> or <stddef.h>,
+// one the implementation reserves, or one the code uses itself. Variables with such names are renamed instead.
+bool isFunctionName(const std::string& name);
+
+// appends a function computing every tree in outputs to out; the variables become parameters in name order.
+// In scalar form one output is returned and several are written to out[]; labels, if given, name each output
+// in a comment
+void generateCode(const std::vector<const NodeBase*>& outputs, const std::vector<std::string>& labels, const CodeOptions& options,
+                  std::string& out);
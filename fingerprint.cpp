@@ -0,0 +1,252 @@
+#include "fingerprint.h"
+#include "stack.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using std::string;
+
+namespace {
+
+// the largest primes below 2^62, so a sum of two residues can't overflow
+const uint64_t primes[maxRounds] = {0x3fffffffffffffc7, 0x3fffffffffffffa9, 0x3fffffffffffff8b, 0x3fffffffffffff71};
+
+const uint64_t undefined = UINT64_MAX; // outside every field
+
+// splitmix64 finalizer
+uint64_t mix(uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+
+    return h ^ (h >> 31);
+}
+
+uint64_t mix(uint64_t a, uint64_t b) {
+    return mix(a ^ mix(b + 0x9e3779b97f4a7c15ULL));
+}
+
+// FNV-1a, which unlike std::hash is the same in every build
+uint64_t hashName(const string& name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (char c : name) {
+        h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+uint64_t add(uint64_t a, uint64_t b, uint64_t p) {
+    uint64_t sum = a + b;
+    return sum >= p ? sum - p : sum;
+}
+
+uint64_t subtract(uint64_t a, uint64_t b, uint64_t p) {
+    return a >= b ? a - b : a + p - b;
+}
+
+uint64_t multiply(uint64_t a, uint64_t b, uint64_t p) {
+    return static_cast<unsigned __int128>(a) * b % p;
+}
+
+uint64_t power(uint64_t base, uint64_t e, uint64_t p) {
+    uint64_t result = 1;
+
+    for (; e > 0; e >>= 1) {
+        if (e & 1) {
+            result = multiply(result, base, p);
+        }
+
+        base = multiply(base, base, p);
+    }
+
+    return result;
+}
+
+// undefined for 0, by Fermat's little theorem otherwise
+uint64_t inverse(uint64_t a, uint64_t p) {
+    return a == 0 ? undefined : power(a, p - 2, p);
+}
+
+// the value of an exponent made of integers, +, - and *, false for anything else or on overflow
+bool constantExponent(const NodeBase& node, int64_t& e) {
+    checkStack();
+    NodeType type = node.getType();
+
+    if (type == NodeType::Val) {
+        e = static_cast<const NodeVal&>(node).val;
+        return true;
+    } else if (type == NodeType::AddInverse) {
+        return constantExponent(static_cast<const UnaryNodeBase&>(node).getArg(), e) && ! __builtin_mul_overflow(e, -1, &e);
+    } else if (type != NodeType::Add && type != NodeType::Subtract && type != NodeType::Multiply) {
+        return false;
+    }
+
+    const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+    int64_t l;
+    int64_t r;
+
+    if (! constantExponent(binary.getLeft(), l) || ! constantExponent(binary.getRight(), r)) {
+        return false;
+    }
+
+    return type == NodeType::Add ? ! __builtin_add_overflow(l, r, &e)
+           : type == NodeType::Subtract ? ! __builtin_sub_overflow(l, r, &e)
+           : ! __builtin_mul_overflow(l, r, &e);
+}
+
+}
+
+bool Fingerprint::operator==(const Fingerprint& other) const {
+    return rounds == other.rounds && std::equal(values, values + rounds, other.values);
+}
+
+string Fingerprint::toString() const {
+    string text;
+    char digits[17];
+
+    for (unsigned int i = 0; i < rounds; ++i) {
+        std::snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(values[i]));
+        text += digits;
+    }
+
+    return text;
+}
+
+size_t FingerprintHash::operator()(const Fingerprint& fingerprint) const {
+    // the residues are already uniformly distributed
+    return fingerprint.values[0] ^ fingerprint.values[1];
+}
+
+struct Fingerprinter::Values {
+    uint64_t values[maxRounds];
+    double degree;
+};
+
+Fingerprinter::Fingerprinter(unsigned int rounds, uint64_t seed) : rounds(std::clamp(rounds, 1u, maxRounds)), seed(mix(seed)) {
+}
+
+Fingerprint Fingerprinter::fingerprint(const NodeBase& node) const {
+    Values result;
+    evaluate(node, result);
+
+    Fingerprint fingerprint{{}, rounds, result.degree};
+    std::copy(result.values, result.values + rounds, fingerprint.values);
+
+    return fingerprint;
+}
+
+bool Fingerprinter::equivalent(const NodeBase& a, const NodeBase& b) const {
+    return fingerprint(a) == fingerprint(b);
+}
+
+double Fingerprinter::errorBound(const Fingerprint& a, const Fingerprint& b) const {
+    // the numerator of a - b has at most this degree, and a nonzero one vanishes at a random point with probability degree / p
+    double chance = std::min(1.0, (a.degree + b.degree) / 0x1p62);
+
+    return std::pow(chance, rounds);
+}
+
+void Fingerprinter::evaluate(const NodeBase& node, Values& out) const {
+    checkStack();
+    NodeType type = node.getType();
+
+    switch (type) {
+        case NodeType::Val: {
+            int64_t val = static_cast<const NodeVal&>(node).val;
+
+            for (unsigned int i = 0; i < rounds; ++i) {
+                out.values[i] = val < 0 ? primes[i] - static_cast<uint64_t>(-val) : static_cast<uint64_t>(val);
+            }
+
+            out.degree = 0;
+            return;
+        }
+        case NodeType::Var: {
+            uint64_t h = mix(seed, hashName(symbolName(static_cast<const NodeVar&>(node).symbol)));
+
+            for (unsigned int i = 0; i < rounds; ++i) {
+                out.values[i] = mix(h, i) % primes[i];
+            }
+
+            out.degree = 1;
+            return;
+        }
+        case NodeType::AddInverse:
+            evaluate(static_cast<const UnaryNodeBase&>(node).getArg(), out);
+
+            for (unsigned int i = 0; i < rounds; ++i) {
+                out.values[i] = out.values[i] == undefined ? undefined : subtract(0, out.values[i], primes[i]);
+            }
+            return;
+        case NodeType::Sin:
+        case NodeType::Cos:
+        case NodeType::Exp:
+        case NodeType::Log: {
+            evaluate(static_cast<const UnaryNodeBase&>(node).getArg(), out);
+
+            for (unsigned int i = 0; i < rounds; ++i) {
+                uint64_t& val = out.values[i];
+
+                // an argument that is 0 or 1 everywhere is almost surely 0 or 1 here, and the other way round
+                if (val == undefined) {
+                } else if (val == 0) {
+                    val = type == NodeType::Sin ? 0 : type == NodeType::Log ? undefined : 1;
+                } else if (val == 1 && type == NodeType::Log) {
+                    val = 0;
+                } else {
+                    val = mix(mix(seed, static_cast<uint64_t>(type)), val) % primes[i];
+                }
+            }
+
+            out.degree = 1;
+            return;
+        }
+        default:
+            break;
+    }
+
+    const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+    Values right{};
+    evaluate(binary.getLeft(), out);
+    int64_t e = 0;
+    bool constant = type == NodeType::Exponent && constantExponent(binary.getRight(), e);
+
+    if (! constant) {
+        evaluate(binary.getRight(), right);
+    }
+
+    for (unsigned int i = 0; i < rounds; ++i) {
+        uint64_t p = primes[i];
+        uint64_t& l = out.values[i];
+        uint64_t r = right.values[i];
+
+        if (l == undefined || (! constant && r == undefined)) {
+            l = undefined;
+            continue;
+        }
+
+        switch (type) {
+            case NodeType::Add: l = add(l, r, p); break;
+            case NodeType::Subtract: l = subtract(l, r, p); break;
+            case NodeType::Multiply: l = multiply(l, r, p); break;
+            case NodeType::Divide: r = inverse(r, p); l = r == undefined ? undefined : multiply(l, r, p); break;
+            default:
+                if (! constant) {
+                    l = mix(mix(seed, static_cast<uint64_t>(type)), mix(l, r)) % p;
+                } else if (e >= 0) {
+                    l = power(l, e, p); // 0^0 is 1, as in the evaluators
+                } else {
+                    l = inverse(power(l, -static_cast<uint64_t>(e), p), p);
+                }
+                break;
+        }
+    }
+
+    if (type == NodeType::Exponent) {
+        out.degree = constant ? out.degree * std::abs(static_cast<double>(e)) : 1;
+    } else {
+        out.degree += right.degree;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "tree.h"
+
+#include <cstdint>
+#include <string>
+
+/*
+Probabilistic equality of expressions by fingerprinting.
+A fingerprint is the value of the expression at a random point, computed
+exactly modulo a prime near 2^62, once per round with a different prime and
+point. Two expressions that are equal as rational functions always get the
+same fingerprint, whatever order or grouping they are written in; two that
+differ get the same one with probability at most errorBound(), by the
+Schwartz-Zippel lemma, so a few rounds make a collision negligible. One pass
+over the tree, O(nodes) per round.
+Constant integer powers are exact, a negative one taking an inverse. sin,
+cos, exp, log and powers with any other exponent are uninterpreted
+functions: their value is a random function of their arguments'
+fingerprints, so sin(2*x) matches sin(x*2), but identities such as
+sin(x)^2 + cos(x)^2 = 1 or exp(a)*exp(b) = exp(a + b) are not recognised and
+such expressions fingerprint as different; only their values at 0, and log
+at 1, are known. An expression that divides by zero or takes log(0), or does
+so at the chosen point, is undefined; all undefined expressions have the same
+fingerprint.
+Points come from a seed and variable names, not symbol ids, so fingerprints
+are stable between runs and can be compared across processes.
+*/
+
+const unsigned int maxRounds = 4;
+
+struct Fingerprint {
+    uint64_t values[maxRounds]; // one residue per round, unused rounds are 0
+    unsigned int rounds;
+    double degree; // bounds the degree of the expression as a rational function, transcendental nodes counting 1
+
+    bool operator==(const Fingerprint& other) const;
+
+    std::string toString() const; // hexadecimal, 16 digits per round
+};
+
+struct FingerprintHash {
+    size_t operator()(const Fingerprint& fingerprint) const;
+};
+
+class Fingerprinter {
+public:
+    explicit Fingerprinter(unsigned int rounds = 2, uint64_t seed = 0); // rounds is clamped to 1 through maxRounds
+
+    Fingerprint fingerprint(const NodeBase& node) const; // thread safe
+
+    bool equivalent(const NodeBase& a, const NodeBase& b) const;
+
+    // probability that expressions with these fingerprints are equal as fingerprints but not as rational functions
+    double errorBound(const Fingerprint& a, const Fingerprint& b) const;
+
+private:
+    struct Values;
+
+    void evaluate(const NodeBase& node, Values& out) const;
+
+    unsigned int rounds;
+    uint64_t seed;
+};
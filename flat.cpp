@@ -0,0 +1,324 @@
+#include "flat.h"
+
+#include <cmath>
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+using std::make_unique;
+
+namespace {
+
+// operator semantics match NodeBase::evaluate()
+int apply(NodeType type, int l, int r) {
+    switch (type) {
+        case NodeType::AddInverse: return -1 * l;
+        case NodeType::Sin: return sin(l);
+        case NodeType::Cos: return cos(l);
+        case NodeType::Exp: return exp(l);
+        case NodeType::Log: return log(l);
+        case NodeType::Add: return l + r;
+        case NodeType::Subtract: return l - r;
+        case NodeType::Multiply: return l * r;
+        case NodeType::Divide: return l / r;
+        default: return pow(l, r);
+    }
+}
+
+}
+
+FlatTree::FlatTree() : root(0) {
+}
+
+size_t FlatTree::NodeKeyHash::operator()(const NodeKey& key) const {
+    unsigned long long h = (static_cast<unsigned long long>(key.left) << 32 | key.right) ^ static_cast<unsigned long long>(key.type) << 59;
+
+    // splitmix64 finalizer
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+
+    return h ^ (h >> 31);
+}
+
+unsigned int FlatTree::append(NodeType type, unsigned int left, unsigned int right) {
+    auto [it, inserted] = unique.try_emplace(NodeKey{type, left, right}, types.size());
+
+    if (inserted) {
+        types.push_back(type);
+        lefts.push_back(left);
+        rights.push_back(right);
+    }
+
+    root = it->second;
+
+    return root;
+}
+
+unsigned int FlatTree::addVal(int val) {
+    return append(NodeType::Val, static_cast<unsigned int>(val), 0);
+}
+
+unsigned int FlatTree::addVar(Symbol symbol) {
+    return append(NodeType::Var, symbol, 0);
+}
+
+unsigned int FlatTree::addUnary(NodeType type, unsigned int arg) {
+    return append(type, arg, 0);
+}
+
+unsigned int FlatTree::addBinary(NodeType type, unsigned int left, unsigned int right) {
+    return append(type, left, right);
+}
+
+unsigned int FlatTree::size() const {
+    return types.size();
+}
+
+bool FlatTree::empty() const {
+    return types.empty();
+}
+
+unsigned int FlatTree::getRoot() const {
+    return root;
+}
+
+void FlatTree::setRoot(unsigned int index) {
+    root = index;
+}
+
+NodeType FlatTree::getType(unsigned int index) const {
+    return types[index];
+}
+
+unsigned int FlatTree::getArg(unsigned int index) const {
+    return lefts[index];
+}
+
+unsigned int FlatTree::getLeft(unsigned int index) const {
+    return lefts[index];
+}
+
+unsigned int FlatTree::getRight(unsigned int index) const {
+    return rights[index];
+}
+
+int FlatTree::getVal(unsigned int index) const {
+    return static_cast<int>(lefts[index]);
+}
+
+Symbol FlatTree::getSymbol(unsigned int index) const {
+    return lefts[index];
+}
+
+vector<bool> FlatTree::reachable(unsigned int index) const {
+    vector<bool> used(index + 1, false);
+    used[index] = true;
+
+    // children always precede their parents, so one backwards sweep suffices
+    for (unsigned int i = index + 1; i-- > 0;) {
+        if (! used[i] || types[i] == NodeType::Val || types[i] == NodeType::Var) {
+            continue;
+        }
+
+        used[lefts[i]] = true;
+
+        if (types[i] >= NodeType::Add) {
+            used[rights[i]] = true;
+        }
+    }
+
+    return used;
+}
+
+int FlatTree::evaluate(const Bindings& bindings) const {
+    return empty() ? 0 : evaluate(root, bindings);
+}
+
+int FlatTree::evaluate(unsigned int index, const Bindings& bindings) const {
+    vector<bool> used = reachable(index);
+    vector<int> values(index + 1);
+
+    for (unsigned int i = 0; i <= index; ++i) {
+        if (! used[i]) {
+            continue;
+        }
+
+        if (types[i] == NodeType::Val) {
+            values[i] = getVal(i);
+        } else if (types[i] == NodeType::Var) {
+            values[i] = bindings[getSymbol(i)];
+        } else {
+            values[i] = apply(types[i], values[lefts[i]], types[i] >= NodeType::Add ? values[rights[i]] : 0);
+        }
+    }
+
+    return values[index];
+}
+
+string FlatTree::toString() const {
+    string out;
+
+    if (! empty()) {
+        print(root, out);
+    }
+
+    return out;
+}
+
+void FlatTree::print(unsigned int index, string& out) const {
+    // text still to print, the last entry next: a node, or a literal when text is set
+    struct Piece {
+        unsigned int index;
+        const char* text;
+    };
+
+    vector<Piece> pieces{{index, nullptr}};
+
+    while (! pieces.empty()) {
+        Piece piece = pieces.back();
+        pieces.pop_back();
+
+        if (piece.text != nullptr) {
+            out += piece.text;
+            continue;
+        }
+
+        unsigned int i = piece.index;
+        NodeType type = types[i];
+        int precedence = getPrecedence(type);
+
+        switch (type) {
+            case NodeType::Val:
+                out += std::to_string(getVal(i));
+                continue;
+            case NodeType::Var:
+                out += symbolName(getSymbol(i));
+                continue;
+            case NodeType::AddInverse:
+                if (precedence > getPrecedence(types[lefts[i]])) {
+                    out += "-(";
+                    pieces.push_back({0, ")"});
+                } else {
+                    out += "-";
+                }
+                pieces.push_back({lefts[i], nullptr});
+                continue;
+            case NodeType::Sin:
+            case NodeType::Cos:
+            case NodeType::Exp:
+            case NodeType::Log:
+                out += type == NodeType::Sin ? "sin(" : type == NodeType::Cos ? "cos(" : type == NodeType::Exp ? "exp(" : "log(";
+                pieces.push_back({0, ")"});
+                pieces.push_back({lefts[i], nullptr});
+                continue;
+            default:
+                break;
+        }
+
+        bool leftParens = getPrecedence(types[lefts[i]]) < precedence;
+        // operators group to the left, so a right operand of equal precedence needs parentheses unless the operator is + or *
+        bool rightParens = type == NodeType::Add || type == NodeType::Multiply ? getPrecedence(types[rights[i]]) < precedence
+                                                                               : getPrecedence(types[rights[i]]) <= precedence;
+        const char* op = type == NodeType::Add ? "+"
+                         : type == NodeType::Subtract ? "-"
+                         : type == NodeType::Multiply ? "*"
+                         : type == NodeType::Divide ? "/" : "^";
+
+        if (leftParens) {
+            out += "(";
+        }
+
+        // pushed in reverse
+        if (rightParens) {
+            pieces.push_back({0, ")"});
+        }
+        pieces.push_back({rights[i], nullptr});
+        if (rightParens) {
+            pieces.push_back({0, "("});
+        }
+        pieces.push_back({0, op});
+        if (leftParens) {
+            pieces.push_back({0, ")"});
+        }
+        pieces.push_back({lefts[i], nullptr});
+    }
+}
+
+unique_ptr<NodeBase> FlatTree::toTree() const {
+    return empty() ? nullptr : toTree(root);
+}
+
+unique_ptr<NodeBase> FlatTree::toTree(unsigned int index) const {
+    vector<unique_ptr<NodeBase>> built; // finished subtrees, operands in order
+    vector<std::pair<unsigned int, bool>> stack{{index, false}}; // nodes to build, and whether their operands are built
+
+    while (! stack.empty()) {
+        auto [i, ready] = stack.back();
+        stack.pop_back();
+        NodeType type = types[i];
+
+        if (type == NodeType::Val) {
+            built.push_back(make_unique<NodeVal>(getVal(i)));
+        } else if (type == NodeType::Var) {
+            built.push_back(make_unique<NodeVar>(getSymbol(i)));
+        } else if (! ready) {
+            stack.emplace_back(i, true);
+
+            if (type >= NodeType::Add) {
+                stack.emplace_back(rights[i], false);
+            }
+
+            stack.emplace_back(lefts[i], false);
+        } else if (type >= NodeType::Add) {
+            unique_ptr<NodeBase> right = std::move(built.back());
+            built.pop_back();
+            built.back() = makeBinaryNode(type, std::move(built.back()), std::move(right));
+        } else {
+            built.back() = makeUnaryNode(type, std::move(built.back()));
+        }
+    }
+
+    return std::move(built.back());
+}
+
+FlatTree FlatTree::fromTree(const NodeBase& node) {
+    FlatTree tree;
+    tree.root = tree.append(node);
+
+    return tree;
+}
+
+unsigned int FlatTree::append(const NodeBase& node) {
+    vector<unsigned int> built; // indices of finished subtrees, operands in order
+    vector<std::pair<const NodeBase*, bool>> stack{{&node, false}}; // nodes to append, and whether their operands are
+
+    while (! stack.empty()) {
+        auto [next, ready] = stack.back();
+        stack.pop_back();
+        NodeType type = next->getType();
+
+        if (type == NodeType::Val) {
+            built.push_back(addVal(static_cast<const NodeVal*>(next)->val));
+        } else if (type == NodeType::Var) {
+            built.push_back(addVar(static_cast<const NodeVar*>(next)->symbol));
+        } else if (! ready) {
+            stack.emplace_back(next, true);
+
+            if (type >= NodeType::Add) {
+                const BinaryNodeBase* binary = static_cast<const BinaryNodeBase*>(next);
+                stack.emplace_back(&binary->getRight(), false);
+                stack.emplace_back(&binary->getLeft(), false);
+            } else {
+                stack.emplace_back(&static_cast<const UnaryNodeBase*>(next)->getArg(), false);
+            }
+        } else if (type >= NodeType::Add) {
+            unsigned int right = built.back();
+            built.pop_back();
+            built.back() = addBinary(type, built.back(), right);
+        } else {
+            built.back() = addUnary(type, built.back());
+        }
+    }
+
+    return built.back();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "tree.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Flat expression DAG stored in a single arena.
+Each node is an entry in parallel arrays (type tag + two child indices) and is
+always appended after its children, so a forward walk over the arena visits
+operands before the nodes that use them.
+
+Nodes are hash-consed: adding a node that already exists returns the existing
+index, so structurally equal subtrees are stored once and compare equal by index.
+*/
+
+class FlatTree {
+public:
+    FlatTree();
+
+    unsigned int addVal(int val);
+
+    unsigned int addVar(Symbol symbol);
+
+    unsigned int addUnary(NodeType type, unsigned int arg);
+
+    unsigned int addBinary(NodeType type, unsigned int left, unsigned int right);
+
+    int evaluate(const Bindings& bindings = {}) const;
+
+    std::string toString() const;
+
+    std::unique_ptr<NodeBase> toTree() const;
+
+    static FlatTree fromTree(const NodeBase& node);
+
+    unsigned int size() const;
+
+    bool empty() const;
+
+    unsigned int getRoot() const;
+
+    void setRoot(unsigned int index);
+
+    NodeType getType(unsigned int index) const;
+
+    unsigned int getArg(unsigned int index) const; // unary nodes
+
+    unsigned int getLeft(unsigned int index) const; // binary nodes
+
+    unsigned int getRight(unsigned int index) const; // binary nodes
+
+    int getVal(unsigned int index) const; // NodeType::Val
+
+    Symbol getSymbol(unsigned int index) const; // NodeType::Var
+
+    std::vector<bool> reachable(unsigned int index) const; // nodes used by the subtree at index
+
+private:
+    struct NodeKey {
+        NodeType type;
+        unsigned int left;
+        unsigned int right;
+
+        bool operator==(const NodeKey& other) const = default;
+    };
+
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& key) const;
+    };
+
+    unsigned int append(NodeType type, unsigned int left, unsigned int right);
+
+    int evaluate(unsigned int index, const Bindings& bindings) const;
+
+    void print(unsigned int index, std::string& out) const;
+
+    std::unique_ptr<NodeBase> toTree(unsigned int index) const;
+
+    unsigned int append(const NodeBase& node);
+
+    std::vector<NodeType> types;
+    std::vector<unsigned int> lefts; // first child, or the payload of NodeType::Val / NodeType::Var
+    std::vector<unsigned int> rights; // second child
+    std::unordered_map<NodeKey, unsigned int, NodeKeyHash> unique; // hash-consing table
+    unsigned int root;
+};
@@ -0,0 +1,139 @@
+#include "jacobian.h"
+#include "rewrite.h"
+#include "cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+using std::vector;
+using std::unique_ptr;
+
+namespace {
+
+// sorts symbols by name and removes repeats
+void normalize(vector<Symbol>& symbols) {
+    std::sort(symbols.begin(), symbols.end());
+    symbols.erase(std::unique(symbols.begin(), symbols.end()), symbols.end());
+    std::sort(symbols.begin(), symbols.end(), symbolLess);
+}
+
+bool isZero(const NodeBase& node) {
+    return node.getType() == NodeType::Val && static_cast<const NodeVal&>(node).val == 0;
+}
+
+}
+
+unsigned int SparseJacobian::nonzeros() const {
+    return columns.size();
+}
+
+vector<Symbol> dependencies(const NodeBase& node) {
+    vector<Symbol> symbols;
+    vector<const NodeBase*> stack{&node};
+
+    // iterative, so any tree can be scanned; jacobian() differentiates it with derivative(), which checks the stack instead, see stack.h
+    while (! stack.empty()) {
+        const NodeBase* next = stack.back();
+        stack.pop_back();
+        NodeType type = next->getType();
+
+        if (type == NodeType::Var) {
+            symbols.push_back(static_cast<const NodeVar*>(next)->symbol);
+        } else if (type >= NodeType::Add) {
+            const BinaryNodeBase* binary = static_cast<const BinaryNodeBase*>(next);
+            stack.push_back(&binary->getLeft());
+            stack.push_back(&binary->getRight());
+        } else if (type != NodeType::Val) {
+            stack.push_back(&static_cast<const UnaryNodeBase*>(next)->getArg());
+        }
+    }
+
+    normalize(symbols);
+
+    return symbols;
+}
+
+SparseJacobian jacobian(const vector<const NodeBase*>& system, TreeCache* cache, unsigned int threads) {
+    SparseJacobian result;
+    vector<vector<Symbol>> rows(system.size());
+
+    for (size_t i = 0; i < system.size(); ++i) {
+        if (system[i] != nullptr) {
+            rows[i] = dependencies(*system[i]);
+            result.variables.insert(result.variables.end(), rows[i].begin(), rows[i].end());
+        }
+    }
+
+    normalize(result.variables);
+
+    SymbolValues<unsigned int> column;
+
+    for (unsigned int k = 0; k < result.variables.size(); ++k) {
+        column.slot(result.variables[k]) = k;
+    }
+
+    // the structurally nonzero entries in row order; both lists are in name order, so each row is in column order
+    vector<unsigned int> entryRows;
+    vector<unsigned int> entryColumns;
+
+    for (unsigned int i = 0; i < rows.size(); ++i) {
+        for (Symbol symbol : rows[i]) {
+            entryRows.push_back(i);
+            entryColumns.push_back(column[symbol]);
+        }
+    }
+
+    vector<unique_ptr<NodeBase>> derivatives(entryRows.size());
+    std::atomic<size_t> next(0);
+    std::exception_ptr error; // the first one thrown, which stops every thread
+    std::mutex errorMutex;
+
+    auto work = [&] {
+        try {
+            for (size_t k; (k = next.fetch_add(1)) < derivatives.size();) {
+                derivatives[k] = derivative(*system[entryRows[k]], result.variables[entryColumns[k]], cache);
+            }
+        } catch (...) {
+            next.store(derivatives.size());
+            std::lock_guard<std::mutex> lock(errorMutex);
+
+            if (error == nullptr) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    vector<std::thread> workers;
+
+    for (unsigned int t = 1; t < std::min<size_t>(threads, derivatives.size()); ++t) {
+        workers.emplace_back(work);
+    }
+
+    work();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    if (error != nullptr) {
+        std::rethrow_exception(error);
+    }
+
+    result.rowStarts.push_back(0);
+
+    for (size_t k = 0, i = 0; i < rows.size(); ++i) {
+        for (; k < entryRows.size() && entryRows[k] == i; ++k) {
+            if (! isZero(*derivatives[k])) {
+                result.columns.push_back(entryColumns[k]);
+                result.entries.push_back(std::move(derivatives[k]));
+            }
+        }
+
+        result.rowStarts.push_back(result.columns.size());
+    }
+
+    return result;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "tree.h"
+
+#include <memory>
+#include <vector>
+
+/*
+Sparse Jacobians of systems of expressions.
+One scan of each expression finds the variables it reads; every other
+partial derivative is structurally zero and never computed, so the work is
+proportional to the nonzeros rather than to equations times variables. The
+remaining entries are simplified derivatives, like derivative() in rewrite.h,
+computed on several threads when asked; an entry that simplifies to 0, as in
+d/dx (x - x), is dropped as well.
+The result is in compressed sparse row form: the entries of row r are
+columns[rowStarts[r]] through columns[rowStarts[r + 1] - 1], in column order.
+*/
+
+class TreeCache;
+
+struct SparseJacobian {
+    std::vector<Symbol> variables; // one per column, every variable of the system in name order
+    std::vector<unsigned int> rowStarts; // one per row, and one past the last entry
+    std::vector<unsigned int> columns;
+    std::vector<std::unique_ptr<NodeBase>> entries; // the derivative at each column
+
+    unsigned int nonzeros() const;
+};
+
+// the variables node reads, in name order
+std::vector<Symbol> dependencies(const NodeBase& node);
+
+// a null expression is an empty row; the cache, if any, is shared by every entry.
+// Throws DepthError, see stack.h, if an expression is too deep to differentiate
+SparseJacobian jacobian(const std::vector<const NodeBase*>& system, TreeCache* cache = nullptr, unsigned int threads = 1);
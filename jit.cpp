@@ -0,0 +1,435 @@
+#include "jit.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define CAS_JIT 1
+#endif
+
+using std::vector;
+
+namespace {
+
+const unsigned int maxStackRegisters = 256;
+const unsigned int noRegister = ~0u;
+
+#ifdef CAS_JIT
+
+double sine(double x) {
+    return sin(x);
+}
+
+double cosine(double x) {
+    return cos(x);
+}
+
+double exponential(double x) {
+    return exp(x);
+}
+
+double logarithm(double x) {
+    return log(x);
+}
+
+double power(double x, double y) {
+    return pow(x, y);
+}
+
+// x86-64 encodings; vars is kept in rbx and the register file in r12, both callee-saved so they survive libm calls.
+// With two lanes every register holds a pair of rows side by side and the arithmetic is packed; the code loops over
+// the rows itself, with rbx pointing to the columns, r13 to the output, r15 the byte offset of the row pair and r14
+// its end.
+class Assembler {
+public:
+    explicit Assembler(unsigned int lanes) : lanes(lanes), loop(0) {
+    }
+
+    void prologue() {
+        if (lanes == 1) {
+            emit({0x53}); // push rbx
+            emit({0x41, 0x54}); // push r12
+            emit({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8 (calls need a 16 byte aligned stack)
+            emit({0x48, 0x89, 0xFB}); // mov rbx, rdi
+            emit({0x49, 0x89, 0xF4}); // mov r12, rsi
+            return;
+        }
+
+        emit({0x53}); // push rbx
+        emit({0x41, 0x54}); // push r12
+        emit({0x41, 0x55}); // push r13
+        emit({0x41, 0x56}); // push r14
+        emit({0x41, 0x57}); // push r15 (the stack is now 16 byte aligned)
+        emit({0x48, 0x89, 0xFB}); // mov rbx, rdi
+        emit({0x49, 0x89, 0xF4}); // mov r12, rsi
+        emit({0x49, 0x89, 0xD5}); // mov r13, rdx
+        emit({0x49, 0x89, 0xCE}); // mov r14, rcx
+        emit({0x45, 0x31, 0xFF}); // xor r15d, r15d
+        loop = code.size();
+    }
+
+    void epilogue(unsigned int result, bool loaded) {
+        if (! loaded) {
+            loadRegister(0, result);
+        }
+
+        if (lanes == 1) {
+            emit({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+            emit({0x41, 0x5C}); // pop r12
+            emit({0x5B}); // pop rbx
+            emit({0xC3}); // ret
+            return;
+        }
+
+        emit({0x66, 0x43, 0x0F, 0x11, 0x44, 0x3D, 0x00}); // movupd [r13 + r15], xmm0
+        emit({0x49, 0x83, 0xC7, 0x10}); // add r15, 16
+        emit({0x4D, 0x39, 0xF7}); // cmp r15, r14
+        emit({0x0F, 0x82}); // jb loop
+        emit32(loop - (code.size() + 4));
+        emit({0x41, 0x5F}); // pop r15
+        emit({0x41, 0x5E}); // pop r14
+        emit({0x41, 0x5D}); // pop r13
+        emit({0x41, 0x5C}); // pop r12
+        emit({0x5B}); // pop rbx
+        emit({0xC3}); // ret
+    }
+
+    // mov rax, bits; mov [r12 + dest], rax for each lane
+    void storeConstant(unsigned int dest, double val) {
+        uint64_t bits;
+        std::memcpy(&bits, &val, sizeof(bits));
+        emit({0x48, 0xB8});
+        emit64(bits);
+
+        for (unsigned int lane = 0; lane < lanes; ++lane) {
+            emit({0x49, 0x89, 0x84, 0x24});
+            emit32(offset(dest, lane));
+        }
+    }
+
+    // mov rax, [rbx + symbol]; mov [r12 + dest], rax, or with two lanes the pair of rows from the symbol's column
+    void storeVariable(unsigned int dest, unsigned int symbol) {
+        emit({0x48, 0x8B, 0x83});
+        emit32(symbol * 8);
+
+        if (lanes == 1) {
+            emit({0x49, 0x89, 0x84, 0x24});
+        } else {
+            emit({0x66, 0x42, 0x0F, 0x10, 0x04, 0x38}); // movupd xmm0, [rax + r15]
+            emit({0x66, 0x41, 0x0F, 0x11, 0x84, 0x24}); // movupd [r12 + dest], xmm0
+        }
+
+        emit32(offset(dest, 0));
+    }
+
+    // movsd xmm<x>, [r12 + reg], or movupd for every lane
+    void loadRegister(unsigned int x, unsigned int reg) {
+        emit({packedPrefix(), 0x41, 0x0F, 0x10, static_cast<uint8_t>(0x84 | x << 3), 0x24});
+        emit32(offset(reg, 0));
+    }
+
+    // movsd [r12 + reg], xmm0, or movupd for every lane
+    void storeRegister(unsigned int reg) {
+        emit({packedPrefix(), 0x41, 0x0F, 0x11, 0x84, 0x24});
+        emit32(offset(reg, 0));
+    }
+
+    // movsd xmm<x>, [r12 + reg + lane]
+    void loadLane(unsigned int x, unsigned int reg, unsigned int lane) {
+        emit({0xF2, 0x41, 0x0F, 0x10, static_cast<uint8_t>(0x84 | x << 3), 0x24});
+        emit32(offset(reg, lane));
+    }
+
+    // movsd [r12 + reg + lane], xmm0
+    void storeLane(unsigned int reg, unsigned int lane) {
+        emit({0xF2, 0x41, 0x0F, 0x11, 0x84, 0x24});
+        emit32(offset(reg, lane));
+    }
+
+    // addsd, subsd, mulsd or divsd xmm0, [r12 + reg]; packed, the operand is loaded into xmm1 first as it may be unaligned
+    void arithmetic(OpCode op, unsigned int reg) {
+        uint8_t code = op == OpCode::Add ? 0x58 : op == OpCode::Subtract ? 0x5C : op == OpCode::Multiply ? 0x59 : 0x5E;
+
+        if (lanes == 1) {
+            emit({0xF2, 0x41, 0x0F, code, 0x84, 0x24});
+            emit32(offset(reg, 0));
+        } else {
+            loadRegister(1, reg);
+            emit({0x66, 0x0F, code, 0xC1}); // addpd, subpd, mulpd or divpd xmm0, xmm1
+        }
+    }
+
+    // flips the sign bits of xmm0
+    void negate() {
+        emit({0x48, 0xB8});
+        emit64(0x8000000000000000ULL); // mov rax, sign bit
+        emit({0x66, 0x48, 0x0F, 0x6E, 0xC8}); // movq xmm1, rax
+
+        if (lanes > 1) {
+            emit({0x66, 0x0F, 0x6C, 0xC9}); // punpcklqdq xmm1, xmm1
+        }
+
+        emit({0x66, 0x0F, 0x57, 0xC1}); // xorpd xmm0, xmm1
+    }
+
+    // arguments in xmm0 and xmm1, result in xmm0
+    void call(const void* function) {
+        emit({0x48, 0xB8});
+        emit64(reinterpret_cast<uint64_t>(function)); // mov rax, function
+        emit({0xFF, 0xD0}); // call rax
+    }
+
+    unsigned int getLanes() const {
+        return lanes;
+    }
+
+    const vector<uint8_t>& getCode() const {
+        return code;
+    }
+
+private:
+    uint32_t offset(unsigned int slot, unsigned int lane) const {
+        return (slot * lanes + lane) * 8;
+    }
+
+    uint8_t packedPrefix() const {
+        return lanes == 1 ? 0xF2 : 0x66;
+    }
+
+    void emit(std::initializer_list<uint8_t> bytes) {
+        code.insert(code.end(), bytes);
+    }
+
+    void emit32(uint32_t val) {
+        for (int i = 0; i < 4; ++i) {
+            code.push_back(val >> (8 * i));
+        }
+    }
+
+    void emit64(uint64_t val) {
+        for (int i = 0; i < 8; ++i) {
+            code.push_back(val >> (8 * i));
+        }
+    }
+
+    unsigned int lanes;
+    size_t loop; // start of the loop body
+    vector<uint8_t> code;
+};
+
+// libm has no packed entry points, so each lane is passed through on its own
+void callPerLane(Assembler& assembler, const Instruction& instruction, const void* function) {
+    for (unsigned int lane = 0; lane < assembler.getLanes(); ++lane) {
+        assembler.loadLane(0, instruction.a, lane);
+
+        if (instruction.op == OpCode::Exponent) {
+            assembler.loadLane(1, instruction.b, lane);
+        }
+
+        assembler.call(function);
+        assembler.storeLane(instruction.dest, lane);
+    }
+}
+
+const void* libmFunction(OpCode op) {
+    switch (op) {
+        case OpCode::Sin: return reinterpret_cast<const void*>(&sine);
+        case OpCode::Cos: return reinterpret_cast<const void*>(&cosine);
+        case OpCode::Exp: return reinterpret_cast<const void*>(&exponential);
+        case OpCode::Log: return reinterpret_cast<const void*>(&logarithm);
+        case OpCode::Exponent: return reinterpret_cast<const void*>(&power);
+        default: return nullptr;
+    }
+}
+
+vector<uint8_t> assemble(const Program& program, unsigned int lanes) {
+    Assembler assembler(lanes);
+    assembler.prologue();
+    unsigned int held = noRegister; // the register xmm0 still holds, an operand that needn't be loaded again
+
+    for (const Instruction& instruction : program.getCode()) {
+        switch (instruction.op) {
+            case OpCode::LoadVal:
+                assembler.storeConstant(instruction.dest, static_cast<int>(instruction.a));
+                held = instruction.dest == held ? noRegister : held;
+                continue;
+            case OpCode::LoadVar:
+                assembler.storeVariable(instruction.dest, instruction.a);
+                held = lanes == 1 && instruction.dest != held ? held : noRegister; // the packed copy goes through xmm0
+                continue;
+            case OpCode::Halt:
+                assembler.epilogue(program.getResult(), held == program.getResult());
+                return assembler.getCode();
+            default:
+                break;
+        }
+
+        if (const void* function = libmFunction(instruction.op)) {
+            callPerLane(assembler, instruction, function);
+            held = lanes == 1 ? instruction.dest : noRegister; // xmm0 has the last lane only
+            continue;
+        }
+
+        if (instruction.a != held) {
+            assembler.loadRegister(0, instruction.a);
+        }
+
+        if (instruction.op == OpCode::Negate) {
+            assembler.negate();
+        } else {
+            assembler.arithmetic(instruction.op, instruction.b);
+        }
+
+        assembler.storeRegister(instruction.dest);
+        held = instruction.dest;
+    }
+
+    return assembler.getCode();
+}
+
+#endif
+
+}
+
+NativeFunction::NativeFunction(const Program& program)
+    : program(program), entry(nullptr), batchEntry(nullptr), buffer(nullptr), bufferSize(0) {
+#ifdef CAS_JIT
+    vector<uint8_t> code = assemble(program, 1);
+    size_t batchStart = (code.size() + 15) / 16 * 16;
+    vector<uint8_t> batchCode = assemble(program, 2);
+    code.resize(batchStart, 0xCC); // int3 padding
+    code.insert(code.end(), batchCode.begin(), batchCode.end());
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (code.size() + page - 1) / page * page;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (memory == MAP_FAILED) {
+        return;
+    }
+
+    std::memcpy(memory, code.data(), code.size());
+
+    // the buffer is never writable and executable at once
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return;
+    }
+
+    buffer = memory;
+    bufferSize = size;
+    entry = reinterpret_cast<Entry>(memory);
+    batchEntry = reinterpret_cast<BatchEntry>(static_cast<uint8_t*>(memory) + batchStart);
+#endif
+}
+
+NativeFunction::~NativeFunction() {
+    release();
+}
+
+NativeFunction::NativeFunction(NativeFunction&& other)
+    : program(std::move(other.program)), entry(other.entry), batchEntry(other.batchEntry), buffer(other.buffer), bufferSize(other.bufferSize) {
+    other.entry = nullptr;
+    other.batchEntry = nullptr;
+    other.buffer = nullptr;
+    other.bufferSize = 0;
+}
+
+NativeFunction& NativeFunction::operator=(NativeFunction&& other) {
+    if (this != &other) {
+        release();
+        program = std::move(other.program);
+        entry = other.entry;
+        batchEntry = other.batchEntry;
+        buffer = other.buffer;
+        bufferSize = other.bufferSize;
+        other.entry = nullptr;
+        other.batchEntry = nullptr;
+        other.buffer = nullptr;
+        other.bufferSize = 0;
+    }
+
+    return *this;
+}
+
+double NativeFunction::evaluate(const double* vars) const {
+    if (entry == nullptr) {
+        Columns columns;
+
+        for (Symbol symbol = 0; symbol < program.getSymbolBound(); ++symbol) {
+            columns.slot(symbol) = vars + symbol;
+        }
+
+        double result;
+        program.evaluate(columns, 1, &result);
+
+        return result;
+    }
+
+    unsigned int registers = program.getRegisterCount();
+
+    if (registers <= maxStackRegisters) {
+        double regs[maxStackRegisters];
+        return entry(vars, regs);
+    }
+
+    vector<double> regs(registers);
+
+    return entry(vars, regs.data());
+}
+
+void NativeFunction::evaluate(const Columns& columns, unsigned int rows, double* out) const {
+    if (entry == nullptr) {
+        program.evaluate(columns, rows, out);
+        return;
+    }
+
+    // the packed code runs over pairs of rows and reads every symbol below the bound, so unbound ones get a column of 0
+    unsigned int pairs = rows / 2;
+    vector<const double*> pointers(program.getSymbolBound());
+    vector<double> zeros;
+    vector<double> regs(2 * program.getRegisterCount());
+
+    for (Symbol symbol = 0; symbol < program.getSymbolBound(); ++symbol) {
+        pointers[symbol] = columns[symbol];
+
+        if (pointers[symbol] == nullptr) {
+            zeros.resize(rows);
+            pointers[symbol] = zeros.data();
+        }
+    }
+
+    if (pairs > 0) {
+        batchEntry(pointers.data(), regs.data(), out, pairs * 2 * sizeof(double));
+    }
+
+    // the odd row out goes through the scalar code
+    if (rows % 2 != 0) {
+        vector<double> vars(program.getSymbolBound());
+
+        for (Symbol symbol = 0; symbol < program.getSymbolBound(); ++symbol) {
+            vars[symbol] = pointers[symbol][rows - 1];
+        }
+
+        out[rows - 1] = entry(vars.data(), regs.data());
+    }
+}
+
+bool NativeFunction::isNative() const {
+    return entry != nullptr;
+}
+
+void NativeFunction::release() {
+#ifdef CAS_JIT
+    if (buffer != nullptr) {
+        munmap(buffer, bufferSize);
+    }
+#endif
+
+    entry = nullptr;
+    batchEntry = nullptr;
+    buffer = nullptr;
+    bufferSize = 0;
+}
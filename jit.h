@@ -0,0 +1,50 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <vector>
+
+/*
+Native code for Program, on x86-64 Linux.
+Each instruction is lowered to SSE2 double arithmetic on a register file in
+memory, so the machine code needs no register allocator of its own; sin, cos,
+exp, log and pow call into libm. Every program is assembled twice: scalar for
+single evaluations, and for columns a loop over pairs of rows, which keeps two
+rows per register and does the arithmetic packed with addpd, mulpd and so on;
+libm is called once per lane. The code is written to an mmap'd
+buffer which is made executable, and never writable, once it is complete.
+Semantics match Program's batch evaluation: double precision, sin/cos take
+radians, though its vectorized sin, cos, exp and log may differ from libm in
+the last bit or two. On other targets the bytecode is interpreted instead.
+*/
+
+class NativeFunction {
+public:
+    explicit NativeFunction(const Program& program);
+    ~NativeFunction();
+
+    NativeFunction(NativeFunction&& other);
+    NativeFunction& operator=(NativeFunction&& other);
+
+    NativeFunction(const NativeFunction&) = delete;
+    NativeFunction& operator=(const NativeFunction&) = delete;
+
+    double evaluate(const double* vars) const; // vars is indexed by symbol, getSymbolBound() entries of the program
+
+    // one column of rows values per variable symbol, unbound symbols read as 0
+    void evaluate(const Columns& columns, unsigned int rows, double* out) const;
+
+    bool isNative() const; // false when the bytecode is interpreted
+
+private:
+    using Entry = double (*)(const double* vars, double* regs);
+    using BatchEntry = void (*)(const double* const* columns, double* regs, double* out, size_t bytes); // bytes of out, a nonzero multiple of 16
+
+    void release();
+
+    Program program; // kept for the interpreter fallback
+    Entry entry; // null when there is no native code
+    BatchEntry batchEntry; // likewise
+    void* buffer;
+    size_t bufferSize;
+};
@@ -1,38 +1,256 @@
 #include "tree.h"
 #include "token.h"
 #include "parse.h"
+#include "batch.h"
+#include "server.h"
+#include "codegen.h"
+#include "autodiff.h"
+#include "rewrite.h"
+#include "numeric.h"
+#include "cache.h"
+#include "fingerprint.h"
+#include "stack.h"
+#include <algorithm>
+#include <charconv>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
 
 using std::string;
 using std::cin;
 using std::cout;
 using std::endl;
-using std::vector;
 using std::unique_ptr;
-
-enum class Mode{EVAL, DIFF};
+using std::vector;
 
 void help() {
     cout << "Commands: " << endl;
     cout << "Evaluation mode: /e" << endl;
-    cout << "Differentiate mode: /d <wrt>" << endl;
+    cout << "Number type: /t int|int64|float|double|complex" << endl;
+    cout << "Differentiate mode: /d <wrt>[^<order>]... (e.g. /d x^2 y)" << endl;
+    cout << "Derivative value mode: /v <wrt>" << endl;
+    cout << "Gradient mode: /g" << endl;
+    cout << "Taylor series mode: /p <wrt> [<order>]" << endl;
+    cout << "Set variable: /s <var> <val>" << endl;
+    cout << "Compare: /c <expression> = <expression>" << endl;
     cout << "Help: /h" << endl;
     cout << "Quit: /q" << endl;
 }
 
-void header(Mode m, char wrt) {
-    if (m == Mode::DIFF) {
-        cout << "Differentiation mode (wrt " << wrt << "):" << endl;
+// d/dx, or d^3/dx^2dy for x, y, x; the variables are grouped in name order, as partialDerivative() takes them
+string partialName(vector<Symbol> wrts) {
+    std::stable_sort(wrts.begin(), wrts.end(), symbolLess);
+    string name = wrts.size() > 1 ? "d^" + std::to_string(wrts.size()) + "/" : "d/";
+
+    for (size_t i = 0, j = 0; i < wrts.size(); i = j) {
+        while (j < wrts.size() && wrts[j] == wrts[i]) {
+            ++j;
+        }
+
+        name += "d" + symbolName(wrts[i]);
+
+        if (j - i > 1) {
+            name += "^" + std::to_string(j - i);
+        }
+    }
+
+    return name;
+}
+
+// wrts holds the variables of a partial derivative in DIFF mode, just the one in DVAL mode
+void header(Mode m, const vector<Symbol>& wrts) {
+    if (m == Mode::DIFF && wrts.size() > 1) {
+        cout << "Differentiation mode (" << partialName(wrts) << "):" << endl;
+    } else if (m == Mode::DIFF) {
+        cout << "Differentiation mode (wrt " << symbolName(wrts[0]) << "):" << endl;
+    } else if (m == Mode::DVAL) {
+        cout << "Derivative value mode (wrt " << symbolName(wrts[0]) << "):" << endl;
+    } else if (m == Mode::GRAD) {
+        cout << "Gradient mode:" << endl;
+    } else if (m == Mode::TAYLOR) {
+        cout << "Taylor series mode (wrt " << symbolName(wrts[0]) << "):" << endl;
     } else {
         cout << "Evaluation mode:" << endl;
     }
 }
 
+// the variable named after a command such as /d, x if there is none
+Symbol readWrt(const string& command) {
+    std::istringstream in(command.substr(2));
+    string name;
+
+    return intern(in >> name ? name : "x");
+}
+
+// the variables of a partial derivative, each repeated by its order, so "x^2 y" gives x, x, y; x if there are none.
+// Returns false if an order is malformed
+bool parsePartial(const string& spec, vector<Symbol>& wrts) {
+    std::istringstream in(spec);
+    string term;
+    vector<Symbol> result;
+
+    while (in >> term) {
+        size_t caret = term.find('^');
+        string name = term.substr(0, caret);
+        string order = caret == string::npos ? "1" : term.substr(caret + 1);
+
+        if (name.empty() || order.empty() || order.size() > 2 || ! std::all_of(order.begin(), order.end(), isdigit) || std::stoi(order) == 0) {
+            return false;
+        }
+
+        result.insert(result.end(), std::stoi(order), intern(name));
+    }
+
+    if (result.empty()) {
+        result.push_back(intern("x"));
+    }
+
+    wrts = std::move(result);
+
+    return true;
+}
+
+const unsigned int maxThreads = 1024; // for -j and --split
+
+// parses the whole of text as a decimal number from min to max, false if it isn't one
+template <typename T>
+bool parseNumber(const string& text, T min, T max, T& result) {
+    T val;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), val);
+
+    if (error != std::errc() || end != text.data() + text.size() || val < min || val > max) {
+        return false;
+    }
+
+    result = val;
+
+    return true;
+}
+
+void usage() {
+    std::cerr << "Usage: cas [--batch <file> [--mode eval|diff|fingerprint|jacobian] [--type <number type>] [--wrt <var>] [-j <threads>] [--cache <entries>] [--split <threads>] [-o <file>]]" << endl;
+    std::cerr << "       cas --serve <socket path or port> [--type <number type>] [-j <threads>] [--cache <entries>]" << endl;
+    std::cerr << "       cas --emit <expression> [--d <wrt>[^<order>]...]... [--name <function>] [--form scalar|loop] [-o <file>]" << endl;
+}
+
+// parses command line options for batch mode, returns false on malformed input
+bool parseOptions(int argc, char** argv, BatchOptions& options) {
+    vector<Symbol> wrts;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        string val = argv[++i];
+
+        if (arg == "--batch") {
+            options.input = val;
+        } else if (arg == "--serve") {
+            options.serve = val;
+        } else if (arg == "--emit") {
+            options.emit = val;
+        } else if (arg == "--d" && parsePartial(val, wrts)) {
+            options.partials.push_back(val);
+        } else if (arg == "--name" && isFunctionName(val)) {
+            options.code.name = val;
+        } else if (arg == "--form" && (val == "scalar" || val == "loop")) {
+            options.code.loop = val == "loop";
+        } else if (arg == "-o") {
+            options.output = val;
+        } else if (arg == "--mode" && (val == "eval" || val == "diff" || val == "fingerprint" || val == "jacobian")) {
+            options.mode = val == "eval" ? Mode::EVAL : val == "diff" ? Mode::DIFF : val == "fingerprint" ? Mode::FINGERPRINT : Mode::JACOBIAN;
+        } else if (arg == "--type" && parseNumberType(val, options.numbers)) {
+        } else if (arg == "--wrt" && ! val.empty()) {
+            options.wrt = val;
+        } else if (arg == "-j" && parseNumber(val, 1u, maxThreads, options.threads)) {
+        } else if (arg == "--cache" && parseNumber(val, size_t(0), SIZE_MAX, options.cacheEntries)) {
+        } else if (arg == "--split" && parseNumber(val, 0u, maxThreads, options.splitThreads)) {
+        } else {
+            return false;
+        }
+    }
+
+    return (! options.input.empty()) + (! options.serve.empty()) + (! options.emit.empty()) == 1;
+}
+
+// writes C source for options.emit followed by the partial derivatives in options.partials, see codegen.h
+int emit(const BatchOptions& options) {
+    unique_ptr<NodeBase> node;
+
+    try {
+        node = buildTree(options.emit);
+    } catch (const SyntaxError& e) {
+        std::cerr << "cas: error at position " << e.getPos() << ": " << e.what() << endl;
+        return 1;
+    }
+
+    vector<unique_ptr<NodeBase>> partials;
+    vector<const NodeBase*> outputs{node.get()};
+    vector<string> labels{node->toString()};
+    TreeCache cache(4096); // lower orders are shared between the partials
+
+    string code;
+
+    try {
+        for (const string& spec : options.partials) {
+            vector<Symbol> wrts;
+            parsePartial(spec, wrts);
+            partials.push_back(std::move(partialDerivative(*node, wrts, &cache).back().result));
+            outputs.push_back(partials.back().get());
+            labels.push_back(partialName(wrts));
+        }
+
+        generateCode(outputs, labels, options.code, code);
+    } catch (const DepthError& e) {
+        std::cerr << "cas: error: " << e.what() << endl;
+        return 1;
+    }
+
+    if (options.output.empty()) {
+        cout << code;
+        return cout ? 0 : 1;
+    }
+
+    std::ofstream file(options.output);
+    file << code;
+
+    if (! file) {
+        std::cerr << "cas: cannot write " << options.output << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char** argv) {
+    if (argc > 1) {
+        BatchOptions options;
+
+        if (! parseOptions(argc, argv, options)) {
+            usage();
+            return 1;
+        }
+
+        if (! options.emit.empty()) {
+            return emit(options);
+        }
+
+        return options.serve.empty() ? runBatch(options) : runServer(options);
+    }
+
     string expression;
     Mode mode = Mode::EVAL;
-    char wrt = 'x';
+    vector<Symbol> wrts{intern("x")};
+    TreeCache cache(4096); // shared by higher-order derivatives, so asking for the next order reuses the lower ones
+    unsigned int order = 6; // of Taylor series
+    NumberType numbers = NumberType::Int;
+    Point point; // variable values, converted to the number type when evaluating
 
     help(); 
 
@@ -44,27 +262,144 @@ int main(int argc, char** argv) {
             continue;
         } else if (expression == "/e") {
             mode = Mode::EVAL;
-            header(mode, wrt);
+            header(mode, wrts);
             continue;
         } else if (expression.substr(0, 2) == "/d") {
-            mode = Mode::DIFF;
-            wrt = expression.length() > 3 ? expression[3] : 'x';
-            header(mode, wrt);
+            if (parsePartial(expression.substr(2), wrts)) {
+                mode = Mode::DIFF;
+                header(mode, wrts);
+            } else {
+                cout << "Usage: /d <wrt>[^<order>]..." << endl;
+            }
+            continue;
+        } else if (expression.substr(0, 2) == "/v") {
+            mode = Mode::DVAL;
+            wrts = {readWrt(expression)};
+            header(mode, wrts);
+            continue;
+        } else if (expression.substr(0, 2) == "/p") {
+            std::istringstream in(expression.substr(2));
+            string var;
+            string digits = "6";
+
+            if (in >> var) {
+                in >> digits;
+            }
+
+            if (digits.size() <= 3 && std::all_of(digits.begin(), digits.end(), isdigit)) {
+                mode = Mode::TAYLOR;
+                wrts = {intern(var.empty() ? "x" : var)};
+                order = std::stoi(digits);
+                header(mode, wrts);
+            } else {
+                cout << "Usage: /p <wrt> [<order>]" << endl;
+            }
+            continue;
+        } else if (expression.substr(0, 2) == "/t") {
+            std::istringstream in(expression.substr(2));
+            string name;
+
+            if (! (in >> name) || ! parseNumberType(name, numbers)) {
+                cout << "Usage: /t int|int64|float|double|complex" << endl;
+            }
+            continue;
+        } else if (expression == "/g") {
+            mode = Mode::GRAD;
+            header(mode, wrts);
+            continue;
+        } else if (expression.substr(0, 2) == "/s") {
+            std::istringstream in(expression.substr(2));
+            string var;
+            double val;
+
+            if (in >> var >> val) {
+                point.slot(intern(var)) = val;
+            } else {
+                cout << "Usage: /s <var> <val>" << endl;
+            }
+            continue;
+        } else if (expression.substr(0, 2) == "/c") {
+            size_t equals = expression.find('=');
+
+            if (equals == string::npos) {
+                cout << "Usage: /c <expression> = <expression>" << endl;
+                continue;
+            }
+
+            try {
+                Fingerprinter fingerprinter;
+                Fingerprint a = fingerprinter.fingerprint(*buildTree(expression.substr(2, equals - 2)));
+                Fingerprint b = fingerprinter.fingerprint(*buildTree(expression.substr(equals + 1)));
+
+                if (a == b) {
+                    cout << "Equal, unless by a chance of at most " << fingerprinter.errorBound(a, b) << endl;
+                } else {
+                    cout << "Different, unless equal by an identity of sin, cos, exp, log or a non-integer power" << endl;
+                }
+            } catch (const SyntaxError& e) {
+                cout << "Syntax error at position " << e.getPos() << ": " << e.what() << endl;
+            } catch (const DepthError& e) {
+                cout << "Error: " << e.what() << endl;
+            }
             continue;
         }
 
-        vector<Token> tokens = tokenize(expression);
+        try {
+            if (Lexer(expression).peek().type != TokenType::End) {
+                unique_ptr<NodeBase> node = buildTree(expression);
+                if (mode == Mode::EVAL) {
+                    string val;
+                    printValue(*node, numbers, point, val);
+                    cout << "= " << val << endl;
+                } else if (mode == Mode::DIFF) {
+                    vector<PartialOrder> orders = partialDerivative(*node, wrts, wrts.size() > 1 ? &cache : nullptr);
+                    cout << partialName(wrts) << "(" << expression << ") = ";
+                    orders.back().result->write(cout);
+                    cout << endl;
+
+                    if (orders.size() > 1) {
+                        cout << "Nodes per order:";
+
+                        for (const PartialOrder& order : orders) {
+                            cout << " " << order.nodes;
+                        }
+                        cout << endl;
+                    }
+                } else if (mode == Mode::DVAL) {
+                    Dual result = evaluateDual(*node, point, wrts[0]);
+                    cout << "= " << result.val << ", d/d" << symbolName(wrts[0]) << " = " << result.dot << endl;
+                } else if (mode == Mode::TAYLOR) {
+                    Series series = evaluateTaylor(*node, point, wrts[0], order);
+                    cout << "= " << series[0];
+
+                    for (unsigned int k = 1; k <= order; ++k) {
+                        cout << " + " << series[k] << "*h";
+
+                        if (k > 1) {
+                            cout << "^" << k;
+                        }
+                    }
+                    cout << ", h = " << symbolName(wrts[0]) << " - " << point[wrts[0]] << endl;
+                } else if (mode == Mode::GRAD) {
+                    Gradient gradient = evaluateGradient(*node, point);
+                    std::sort(gradient.symbols.begin(), gradient.symbols.end(), symbolLess);
+                    cout << "= " << gradient.val;
 
-        if (! tokens.empty()) {
-            unique_ptr<NodeBase> node = buildTree(tokens);
-            if (mode == Mode::EVAL) {
-                cout << "= " << node->evaluate() << endl;
-            } else if (mode == Mode::DIFF) {
-                cout << "d/d" << wrt << "(" << expression << ") = " << node->differentiate(wrt)->simplify()->toString() << endl;
+                    for (Symbol symbol : gradient.symbols) {
+                        cout << ", d/d" << symbolName(symbol) << " = " << gradient.partials[symbol];
+                    }
+                    cout << endl;
+                }
             }
+        } catch (const SyntaxError& e) {
+            cout << "Syntax error at position " << e.getPos() << ": " << e.what() << endl;
+        } catch (const std::domain_error& e) {
+            cout << "Error: " << e.what() << endl;
+        } catch (const DepthError& e) {
+            cout << "Error: " << e.what() << endl;
         }
 
-        header(mode, wrt);
+        header(mode, wrts);
     }
 
     return 0;
@@ -0,0 +1,189 @@
+#include "numeric.h"
+#include "stack.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+using std::string;
+using Complex = std::complex<double>;
+
+namespace {
+
+// int64 arithmetic is done in uint64_t, where overflow wraps around
+int64_t wrap(uint64_t val) {
+    return static_cast<int64_t>(val);
+}
+
+// truncates a double result, saturating at the ends of the range
+int64_t truncate(double val) {
+    if (std::isnan(val)) {
+        throw std::domain_error("result is not a number");
+    } else if (val >= 0x1p63) {
+        return INT64_MAX;
+    } else if (val < -0x1p63) {
+        return INT64_MIN;
+    }
+
+    return static_cast<int64_t>(val);
+}
+
+int64_t power(int64_t base, int64_t e) {
+    if (e < 0) {
+        if (base == 0) {
+            throw std::domain_error("division by zero");
+        }
+
+        // only 1 and -1 have reciprocals that don't truncate to 0
+        return base == 1 ? 1 : base == -1 ? (e % 2 == 0 ? 1 : -1) : 0;
+    }
+
+    uint64_t result = 1;
+    uint64_t square = base;
+
+    for (uint64_t n = e; n > 0; n >>= 1) {
+        if (n & 1) {
+            result *= square;
+        }
+
+        square *= square;
+    }
+
+    return wrap(result);
+}
+
+template <typename T>
+T apply(NodeType type, T l, T r) {
+    if constexpr (std::is_integral_v<T>) {
+        switch (type) {
+            case NodeType::AddInverse: return wrap(0 - static_cast<uint64_t>(l));
+            case NodeType::Sin: return truncate(std::sin(l));
+            case NodeType::Cos: return truncate(std::cos(l));
+            case NodeType::Exp: return truncate(std::exp(l));
+            case NodeType::Log:
+                if (l <= 0) {
+                    throw std::domain_error("logarithm of a number that isn't positive");
+                }
+                return truncate(std::log(l));
+            case NodeType::Add: return wrap(static_cast<uint64_t>(l) + static_cast<uint64_t>(r));
+            case NodeType::Subtract: return wrap(static_cast<uint64_t>(l) - static_cast<uint64_t>(r));
+            case NodeType::Multiply: return wrap(static_cast<uint64_t>(l) * static_cast<uint64_t>(r));
+            case NodeType::Divide:
+                if (r == 0) {
+                    throw std::domain_error("division by zero");
+                }
+                return r == -1 ? wrap(0 - static_cast<uint64_t>(l)) : l / r; // INT64_MIN / -1 wraps
+            default: return power(l, r);
+        }
+    } else {
+        switch (type) {
+            case NodeType::AddInverse: return -l;
+            case NodeType::Sin: return std::sin(l);
+            case NodeType::Cos: return std::cos(l);
+            case NodeType::Exp: return std::exp(l);
+            case NodeType::Log: return std::log(l);
+            case NodeType::Add: return l + r;
+            case NodeType::Subtract: return l - r;
+            case NodeType::Multiply: return l * r;
+            case NodeType::Divide: return l / r;
+            default: return std::pow(l, r);
+        }
+    }
+}
+
+template <typename T>
+SymbolValues<T> convert(const SymbolValues<double>& values) {
+    SymbolValues<T> result;
+
+    for (Symbol symbol = 0; symbol < values.size(); ++symbol) {
+        if constexpr (std::is_integral_v<T>) {
+            result.slot(symbol) = static_cast<T>(truncate(values[symbol]));
+        } else {
+            result.slot(symbol) = static_cast<T>(values[symbol]);
+        }
+    }
+
+    return result;
+}
+
+// shortest text that reads back as the same value
+template <typename T>
+void append(T val, string& out) {
+    char digits[32];
+    char* end = std::to_chars(digits, digits + sizeof(digits), val).ptr;
+    out.append(digits, end);
+}
+
+void append(Complex val, string& out) {
+    append(val.real(), out);
+
+    if (! std::signbit(val.imag())) {
+        out += '+';
+    }
+
+    append(val.imag(), out);
+    out += 'i';
+}
+
+}
+
+bool parseNumberType(std::string_view name, NumberType& type) {
+    if (name == "int") {
+        type = NumberType::Int;
+    } else if (name == "int64") {
+        type = NumberType::Int64;
+    } else if (name == "float") {
+        type = NumberType::Float;
+    } else if (name == "double") {
+        type = NumberType::Double;
+    } else if (name == "complex") {
+        type = NumberType::Complex;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+template <typename T>
+T evaluateAs(const NodeBase& node, const SymbolValues<T>& values) {
+    checkStack();
+    NodeType type = node.getType();
+
+    switch (type) {
+        case NodeType::Val:
+            return static_cast<T>(static_cast<const NodeVal&>(node).val);
+        case NodeType::Var:
+            return values[static_cast<const NodeVar&>(node).symbol];
+        case NodeType::AddInverse:
+        case NodeType::Sin:
+        case NodeType::Cos:
+        case NodeType::Exp:
+        case NodeType::Log:
+            return apply(type, evaluateAs(static_cast<const UnaryNodeBase&>(node).getArg(), values), T());
+        default: {
+            const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+            T left = evaluateAs(binary.getLeft(), values);
+
+            return apply(type, left, evaluateAs(binary.getRight(), values));
+        }
+    }
+}
+
+template int evaluateAs(const NodeBase&, const SymbolValues<int>&);
+template int64_t evaluateAs(const NodeBase&, const SymbolValues<int64_t>&);
+template float evaluateAs(const NodeBase&, const SymbolValues<float>&);
+template double evaluateAs(const NodeBase&, const SymbolValues<double>&);
+template Complex evaluateAs(const NodeBase&, const SymbolValues<Complex>&);
+
+void printValue(const NodeBase& node, NumberType type, const SymbolValues<double>& values, string& out) {
+    switch (type) {
+        case NumberType::Int: append(evaluateAs(node, convert<int>(values)), out); break;
+        case NumberType::Int64: append(evaluateAs(node, convert<int64_t>(values)), out); break;
+        case NumberType::Float: append(evaluateAs(node, convert<float>(values)), out); break;
+        case NumberType::Double: append(evaluateAs(node, values), out); break;
+        case NumberType::Complex: append(evaluateAs(node, convert<Complex>(values)), out); break;
+    }
+}
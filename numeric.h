@@ -0,0 +1,35 @@
+#pragma once
+
+#include "tree.h"
+
+#include <complex>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+Evaluation of NodeBase trees in a choice of number types.
+The evaluator is a template instantiated once per type, so values never
+pass through another type on the way. Every type takes sin/cos arguments in
+radians, like NodeBase::evaluate() and the batch evaluator in bytecode.h.
+int and int64 keep the semantics of NodeBase::evaluate(), truncation
+included, except that overflow wraps around instead of being
+undefined. Division by zero, and the logarithm of a number that isn't
+positive, throw std::domain_error, where NodeBase::evaluate() would trap.
+*/
+
+enum class NumberType {Int, Int64, Float, Double, Complex};
+
+bool parseNumberType(std::string_view name, NumberType& type); // false unless name is int, int64, float, double or complex
+
+template <typename T>
+T evaluateAs(const NodeBase& node, const SymbolValues<T>& values);
+
+extern template int evaluateAs(const NodeBase&, const SymbolValues<int>&);
+extern template int64_t evaluateAs(const NodeBase&, const SymbolValues<int64_t>&);
+extern template float evaluateAs(const NodeBase&, const SymbolValues<float>&);
+extern template double evaluateAs(const NodeBase&, const SymbolValues<double>&);
+extern template std::complex<double> evaluateAs(const NodeBase&, const SymbolValues<std::complex<double>>&);
+
+// appends the value of node in type to out; values are converted to type first
+void printValue(const NodeBase& node, NumberType type, const SymbolValues<double>& values, std::string& out);
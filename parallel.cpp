@@ -0,0 +1,197 @@
+#include "parallel.h"
+#include "tree.h"
+
+#include <exception>
+
+using std::shared_ptr;
+
+namespace {
+
+thread_local const ForkJoinPool* currentPool = nullptr; // the pool this thread works for, if any
+thread_local unsigned int currentQueue = 0;
+
+// pushes the children of node onto stack
+void pushChildren(const NodeBase& node, std::vector<const NodeBase*>& stack) {
+    NodeType type = node.getType();
+
+    if (type >= NodeType::Add) {
+        const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+        stack.push_back(&binary.getLeft());
+        stack.push_back(&binary.getRight());
+    } else if (type != NodeType::Val && type != NodeType::Var) {
+        stack.push_back(&static_cast<const UnaryNodeBase&>(node).getArg());
+    }
+}
+
+}
+
+struct ForkJoinPool::Task {
+    const std::function<void()>* run; // owned by the thread that called invoke(), which waits for done
+    std::atomic<bool> claimed{false};
+    std::atomic<bool> done{false};
+    std::exception_ptr error;
+
+    // runs the task unless another thread already has
+    void execute() {
+        if (claimed.exchange(true)) {
+            return;
+        }
+
+        try {
+            (*run)();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        done.store(true, std::memory_order_release);
+    }
+};
+
+ForkJoinPool::ForkJoinPool(unsigned int workers) : queued(0), stopping(false) {
+    for (unsigned int i = 0; i <= workers; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+
+    for (unsigned int i = 0; i < workers; ++i) {
+        threads.emplace_back(&ForkJoinPool::work, this, i);
+    }
+}
+
+ForkJoinPool::~ForkJoinPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    available.notify_all();
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void ForkJoinPool::invoke(const std::function<void()>& a, const std::function<void()>& b) {
+    shared_ptr<Task> task = std::make_shared<Task>();
+    task->run = &b;
+    push(task);
+
+    std::exception_ptr error;
+
+    try {
+        a();
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    // b is stolen or run here; either way it must finish before b goes out of scope
+    task->execute();
+
+    while (! task->done.load(std::memory_order_acquire)) {
+        shared_ptr<Task> other = take();
+
+        if (other != nullptr) {
+            other->execute();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    if (error != nullptr) {
+        std::rethrow_exception(error);
+    } else if (task->error != nullptr) {
+        std::rethrow_exception(task->error);
+    }
+}
+
+void ForkJoinPool::push(shared_ptr<Task> task) {
+    Queue& queue = *queues[currentPool == this ? currentQueue : queues.size() - 1];
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    queued.fetch_add(1);
+
+    // taking the lock orders this with a worker that has just found nothing and is about to sleep
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+
+    available.notify_one();
+}
+
+shared_ptr<ForkJoinPool::Task> ForkJoinPool::take() {
+    unsigned int own = currentPool == this ? currentQueue : queues.size() - 1;
+
+    for (unsigned int i = 0; i < queues.size(); ++i) {
+        Queue& queue = *queues[(own + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (queue.tasks.empty()) {
+            continue;
+        }
+
+        shared_ptr<Task> task;
+
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+
+        queued.fetch_sub(1);
+
+        return task;
+    }
+
+    return nullptr;
+}
+
+void ForkJoinPool::work(unsigned int index) {
+    currentPool = this;
+    currentQueue = index;
+
+    while (true) {
+        shared_ptr<Task> task = take();
+
+        if (task != nullptr) {
+            task->execute();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return queued.load() > 0 || stopping; });
+
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+Split measure(const NodeBase& x, const NodeBase& y, unsigned int limit) {
+    std::vector<const NodeBase*> xs{&x};
+    std::vector<const NodeBase*> ys{&y};
+    unsigned int count = 0;
+
+    // one node of each per step, so the smaller tree runs out first
+    while (count < limit) {
+        if (xs.empty() || ys.empty()) {
+            return Split{! xs.empty(), ! ys.empty()};
+        }
+
+        const NodeBase* a = xs.back();
+        xs.pop_back();
+        pushChildren(*a, xs);
+
+        const NodeBase* b = ys.back();
+        ys.pop_back();
+        pushChildren(*b, ys);
+
+        ++count;
+    }
+
+    return Split{true, true};
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Fork-join parallelism for recursive work on one large tree.
+invoke(a, b) runs a on the calling thread and queues b, which an idle worker
+may steal; if none has by the time a returns, the caller runs b itself. A
+thread waiting for a stolen task runs other queued tasks meanwhile, so nested
+invoke() calls keep threads busy rather than blocked. Threads take their own
+newest task first and steal the oldest of others', which in a recursive split
+are the largest pieces of work.
+Any thread may call invoke(), not only the pool's workers. Nodes are
+allocated by whichever thread builds them, from the allocator's per-thread
+arenas, so workers don't contend on the heap.
+*/
+
+class NodeBase;
+
+class ForkJoinPool {
+public:
+    explicit ForkJoinPool(unsigned int workers);
+    ~ForkJoinPool();
+
+    ForkJoinPool(const ForkJoinPool&) = delete;
+    ForkJoinPool& operator=(const ForkJoinPool&) = delete;
+
+    // returns once both have run; an exception thrown by either is rethrown here
+    void invoke(const std::function<void()>& a, const std::function<void()>& b);
+
+private:
+    struct Task;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Task>> tasks;
+    };
+
+    void push(std::shared_ptr<Task> task);
+
+    std::shared_ptr<Task> take(); // this thread's newest task, else the oldest in another queue
+
+    void work(unsigned int index);
+
+    std::vector<std::unique_ptr<Queue>> queues; // one per worker, the last shared by other threads
+    std::vector<std::thread> threads;
+    std::mutex mutex; // guards sleeping workers
+    std::condition_variable available;
+    std::atomic<size_t> queued; // entries in all queues, including ones already run by their caller
+    bool stopping;
+};
+
+const unsigned int forkNodes = 4096; // subtrees smaller than this aren't split across threads
+
+struct Split {
+    bool leftLarge; // false only if the tree is known to have fewer than limit nodes
+    bool rightLarge;
+};
+
+// walks x and y in step until limit nodes of each are seen or one runs out, so this costs about twice the smaller one,
+// up to limit; the larger tree isn't walked to the end, so it may still turn out small
+Split measure(const NodeBase& x, const NodeBase& y, unsigned int limit);
+
+// runs a and b, which work on x and y, concurrently on pool if there is one and both trees are large enough to be worth it;
+// each is passed the pool to split its own tree further with, null once that tree is known to be too small
+template <typename A, typename B>
+void forkJoin(ForkJoinPool* pool, const NodeBase& x, const NodeBase& y, A&& a, B&& b) {
+    Split split = pool != nullptr ? measure(x, y, forkNodes) : Split{false, false};
+
+    if (split.leftLarge && split.rightLarge) {
+        pool->invoke([&] { a(pool); }, [&] { b(pool); });
+    } else {
+        a(split.leftLarge ? pool : nullptr);
+        b(split.rightLarge ? pool : nullptr);
+    }
+}
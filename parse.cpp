@@ -1,99 +1,368 @@
 #include "parse.h"
-#include <iostream>
 
 using std::unique_ptr;
 
-unique_ptr<NodeBase> buildTree(const std::vector<Token>& tokens) {
-    unsigned int pos = 0;
+namespace {
 
-    return parseExpressionAddition(tokens, pos);
-}
+// builds NodeBase trees
+struct TreeBuilder {
+    using Node = unique_ptr<NodeBase>;
 
-unique_ptr<NodeBase> parseExpressionAddition(const std::vector<Token>& tokens, unsigned int& pos) {
-    unique_ptr<NodeBase> node = parseExpressionMultiplication(tokens, pos);
+    Node val(int val) {
+        return std::make_unique<NodeVal>(val);
+    }
 
-    while (tokens[pos].type == TokenType::Add || tokens[pos].type == TokenType::Subtract) {
-        TokenType operation = tokens[pos].type;
-        ++pos;
-        unique_ptr<NodeBase> right = parseExpressionMultiplication(tokens, pos);
+    Node var(Symbol symbol) {
+        return std::make_unique<NodeVar>(symbol);
+    }
 
-        if (operation == TokenType::Add) {
-            node = std::make_unique<NodeAdd>(std::move(node), std::move(right));
-        } else if (operation == TokenType::Subtract) {
-            node = std::make_unique<NodeSubtract>(std::move(node), std::move(right));
-        }
+    Node unary(NodeType type, Node arg) {
+        return makeUnaryNode(type, std::move(arg));
     }
 
-    return node;
-}
+    Node binary(NodeType type, Node left, Node right) {
+        return makeBinaryNode(type, std::move(left), std::move(right));
+    }
+};
 
-unique_ptr<NodeBase> parseExpressionMultiplication(const std::vector<Token>& tokens, unsigned int& pos) {
-    unique_ptr<NodeBase> node = parseExpressionExponent(tokens, pos);
+// appends nodes to a FlatTree arena
+struct FlatBuilder {
+    using Node = unsigned int;
+
+    FlatTree& tree;
+
+    Node val(int val) {
+        return tree.addVal(val);
+    }
+
+    Node var(Symbol symbol) {
+        return tree.addVar(symbol);
+    }
+
+    Node unary(NodeType type, Node arg) {
+        return tree.addUnary(type, arg);
+    }
+
+    Node binary(NodeType type, Node left, Node right) {
+        return tree.addBinary(type, left, right);
+    }
+};
 
-    while (tokens[pos].type == TokenType::Multiply || tokens[pos].type == TokenType::Divide) {
-        TokenType operation = tokens[pos].type; // Unused for now
-        ++pos;
-        unique_ptr<NodeBase> right = parseExpressionExponent(tokens, pos);
+// reads a pre-tokenized vector, yielding TokenType::End past the last token
+struct VectorStream {
+    const std::vector<Token>& tokens;
+    unsigned int& pos;
 
-        if (operation == TokenType::Multiply) {
-            node = std::make_unique<NodeMultiply>(std::move(node), std::move(right));
-        } else if (operation == TokenType::Divide) {
-            node = std::make_unique<NodeDivide>(std::move(node), std::move(right));
+    const Token& peek() const {
+        static const Token end{TokenType::End, 0, {}, 0};
+
+        return pos < tokens.size() ? tokens[pos] : end;
+    }
+
+    Token next() {
+        Token token = peek();
+
+        if (pos < tokens.size()) {
+            ++pos;
         }
+
+        return token;
     }
+};
 
-    return node;
+const int prefixPrecedence = 4; // above every binary operator, parses a single value
+
+NodeType functionType(std::string_view name) {
+    if (name == "sin") {
+        return NodeType::Sin;
+    } else if (name == "cos") {
+        return NodeType::Cos;
+    } else if (name == "exp") {
+        return NodeType::Exp;
+    } else {
+        return NodeType::Log;
+    }
 }
 
-unique_ptr<NodeBase> parseExpressionExponent(const std::vector<Token>& tokens, unsigned int& pos) {
-    unique_ptr<NodeBase> node = parseExpressionVal(tokens, pos);
+// precedence of a binary operator token, 0 if the token is not one
+int binaryPrecedence(TokenType type, NodeType& nodeType) {
+    switch (type) {
+        case TokenType::Add: nodeType = NodeType::Add; break;
+        case TokenType::Subtract: nodeType = NodeType::Subtract; break;
+        case TokenType::Multiply: nodeType = NodeType::Multiply; break;
+        case TokenType::Divide: nodeType = NodeType::Divide; break;
+        case TokenType::Exponent: nodeType = NodeType::Exponent; break;
+        default: return 0;
+    }
+
+    return getPrecedence(nodeType);
+}
+
+enum class PendingKind {Binary, Prefix, Parentheses};
+
+struct Pending {
+    PendingKind kind;
+    NodeType type;
+    unsigned int pos;
+};
+
+const size_t balancedRun = 16; // longer runs of + or * are built balanced
+
+// an operand that is still a run of terms joined by one associative operator, none if type is NodeType::Val
+struct Run {
+    NodeType type;
+    size_t start; // of its terms
+};
+
+// joins terms[begin..end) with type, which is + or *. Short runs group to the left as written;
+// longer ones are split in halves, so a long sum or product is only logarithmically deep
+template <typename Builder>
+typename Builder::Node join(Builder& builder, NodeType type, std::vector<typename Builder::Node>& terms, size_t begin, size_t end) {
+    if (end - begin > balancedRun) {
+        size_t middle = begin + (end - begin) / 2;
+        typename Builder::Node left = join(builder, type, terms, begin, middle);
+
+        return builder.binary(type, std::move(left), join(builder, type, terms, middle, end));
+    }
+
+    typename Builder::Node node = std::move(terms[begin]);
 
-    while (tokens[pos].type == TokenType::Exponent) {
-        ++pos;
-        unique_ptr<NodeBase> right = parseExpressionVal(tokens, pos);
-        node = std::make_unique<NodeExponent>(std::move(node), std::move(right));
+    for (size_t i = begin + 1; i < end; ++i) {
+        node = builder.binary(type, std::move(node), std::move(terms[i]));
     }
 
     return node;
 }
 
-unique_ptr<NodeBase> parseExpressionVal(const std::vector<Token>& tokens, unsigned int& pos) {
-    bool negate = false;
+/*
+Operator precedence parser with explicit operand and operator stacks, so the
+native stack depth is constant however deeply the input nests. Operands of a
+chain of + or of * are gathered into a run and joined by join() once the run
+ends, so the algorithms that recurse over the tree see a balanced sum rather
+than one level per term.
+Grammar, all binary operators left associative:
+    addition := multiplication (('+' | '-') multiplication)*
+    multiplication := exponent (('*' | '/') exponent)*
+    exponent := val ('^' val)*
+    val := '-'* ('(' addition ')' | function val | variable | number)
+Parsing stops, without consuming it, at the first token outside parentheses
+that cannot continue an expression of at least minPrecedence.
+*/
+template <typename Builder, typename Stream>
+typename Builder::Node parse(Builder& builder, Stream& tokens, int minPrecedence) {
+    using Node = typename Builder::Node;
 
-    while (tokens[pos].type == TokenType::Subtract) {
-        negate = ! negate;
+    std::vector<Node> operands;
+    std::vector<Run> runs; // one per operand
+    std::vector<Node> terms; // of every run, the innermost last
+    std::vector<Pending> pending;
+    std::vector<unsigned int> parentheses; // positions of unclosed (
 
-        ++pos;
-    }
+    auto push = [&](Node node) {
+        operands.push_back(std::move(node));
+        runs.push_back(Run{NodeType::Val, 0});
+    };
 
-    unique_ptr<NodeBase> node;
+    // builds the last operand if it is still a run
+    auto settle = [&]() {
+        Run& run = runs.back();
 
-    if (tokens[pos].type == TokenType::OpenParentheses) {
-        ++pos; // skip (
-        node = parseExpressionAddition(tokens, pos);
-        ++pos; // skip )
-    } else if (tokens[pos].type == TokenType::Function) {
-        std::string function = tokens[pos++].name;
-        unique_ptr<NodeBase> arg = parseExpressionVal(tokens, pos);
+        if (run.type != NodeType::Val) {
+            operands.back() = join(builder, run.type, terms, run.start, terms.size());
+            terms.erase(terms.begin() + run.start, terms.end());
+            run.type = NodeType::Val;
+        }
+    };
+
+    auto reduceBinary = [&]() {
+        NodeType type = pending.back().type;
+        pending.pop_back();
+        settle();
+        Node right = std::move(operands.back());
+        operands.pop_back();
+        runs.pop_back();
+        Run& run = runs.back();
 
-        if (function == "sin") {
-            node = std::make_unique<NodeSin>(std::move(arg));
-        } else if (function == "cos") {
-            node = std::make_unique<NodeCos>(std::move(arg));
-        } else if (function == "exp") {
-            node = std::make_unique<NodeExp>(std::move(arg));
-        } else if (function == "log") {
-            node = std::make_unique<NodeLog>(std::move(arg));
+        if (type != NodeType::Add && type != NodeType::Multiply) {
+            settle();
+            operands.back() = builder.binary(type, std::move(operands.back()), std::move(right));
+            return;
+        } else if (run.type != type) {
+            settle();
+            run = Run{type, terms.size()};
+            terms.push_back(std::move(operands.back()));
+        }
+
+        terms.push_back(std::move(right));
+    };
+
+    // negation and functions apply to a single value, so they are reduced as soon as it is complete
+    auto reducePrefix = [&]() {
+        while (! pending.empty() && pending.back().kind == PendingKind::Prefix) {
+            settle();
+            operands.back() = builder.unary(pending.back().type, std::move(operands.back()));
+            pending.pop_back();
+        }
+    };
+
+    while (true) {
+        const Token& token = tokens.peek();
+
+        switch (token.type) {
+            case TokenType::Subtract:
+                // a run of minus signs collapses to a single negation or none
+                if (! pending.empty() && pending.back().kind == PendingKind::Prefix && pending.back().type == NodeType::AddInverse) {
+                    pending.pop_back();
+                } else {
+                    pending.push_back(Pending{PendingKind::Prefix, NodeType::AddInverse, token.pos});
+                }
+                tokens.next();
+                continue;
+            case TokenType::OpenParentheses:
+                pending.push_back(Pending{PendingKind::Parentheses, NodeType::Val, token.pos});
+                parentheses.push_back(token.pos);
+                tokens.next();
+                continue;
+            case TokenType::Function:
+                pending.push_back(Pending{PendingKind::Prefix, functionType(token.name), token.pos});
+                tokens.next();
+                continue;
+            case TokenType::Variable:
+                push(builder.var(intern(token.name)));
+                tokens.next();
+                break;
+            case TokenType::Number:
+                push(builder.val(token.val));
+                tokens.next();
+                break;
+            default:
+                throw SyntaxError("expected a value", token.pos);
+        }
+
+        reducePrefix();
+
+        // after a value: close parentheses until the next binary operator
+        while (true) {
+            const Token& op = tokens.peek();
+
+            if (op.type == TokenType::CloseParentheses && ! parentheses.empty()) {
+                while (pending.back().kind == PendingKind::Binary) {
+                    reduceBinary();
+                }
+
+                pending.pop_back();
+                parentheses.pop_back();
+                tokens.next();
+                reducePrefix();
+                continue;
+            }
+
+            NodeType type = NodeType::Val;
+            int precedence = binaryPrecedence(op.type, type);
+
+            if (precedence == 0 || (parentheses.empty() && precedence < minPrecedence)) {
+                if (! parentheses.empty()) {
+                    throw op.type == TokenType::End ? SyntaxError("unmatched '('", parentheses.back())
+                                                    : SyntaxError("expected an operator", op.pos);
+                }
+
+                while (! pending.empty()) {
+                    reduceBinary();
+                }
+
+                settle();
+
+                return std::move(operands.back());
+            }
+
+            while (! pending.empty() && pending.back().kind == PendingKind::Binary && getPrecedence(pending.back().type) >= precedence) {
+                reduceBinary();
+            }
+
+            pending.push_back(Pending{PendingKind::Binary, type, op.pos});
+            tokens.next();
+            break;
         }
-    } else if (tokens[pos].type == TokenType::Variable) {
-        node = std::make_unique<NodeVar>(tokens[pos++].name[0]);
-    } else {
-        node = std::make_unique<NodeVal>(tokens[pos++].val);
     }
+}
 
-    if (negate) {
-        return std::make_unique<NodeAddInverse>(std::move(node));
-    } else {
-        return node;
+// parses a whole expression, rejecting anything left over
+template <typename Builder, typename Stream>
+typename Builder::Node parseAll(Builder& builder, Stream& tokens) {
+    typename Builder::Node node = parse(builder, tokens, getPrecedence(NodeType::Add));
+    const Token& token = tokens.peek();
+
+    if (token.type == TokenType::CloseParentheses) {
+        throw SyntaxError("unmatched ')'", token.pos);
+    } else if (token.type != TokenType::End) {
+        throw SyntaxError("expected an operator", token.pos);
     }
+
+    return node;
+}
+
+}
+
+unique_ptr<NodeBase> buildTree(const std::vector<Token>& tokens) {
+    TreeBuilder builder;
+    unsigned int pos = 0;
+    VectorStream stream{tokens, pos};
+
+    return parseAll(builder, stream);
+}
+
+unique_ptr<NodeBase> buildTree(std::string_view expression) {
+    TreeBuilder builder;
+    Lexer lexer(expression);
+
+    return parseAll(builder, lexer);
+}
+
+FlatTree buildFlatTree(const std::vector<Token>& tokens) {
+    FlatTree tree;
+    FlatBuilder builder{tree};
+    unsigned int pos = 0;
+    VectorStream stream{tokens, pos};
+
+    tree.setRoot(parseAll(builder, stream));
+
+    return tree;
+}
+
+FlatTree buildFlatTree(std::string_view expression) {
+    FlatTree tree;
+    FlatBuilder builder{tree};
+    Lexer lexer(expression);
+
+    tree.setRoot(parseAll(builder, lexer));
+
+    return tree;
+}
+
+unique_ptr<NodeBase> parseExpressionAddition(const std::vector<Token>& tokens, unsigned int& pos) {
+    TreeBuilder builder;
+    VectorStream stream{tokens, pos};
+
+    return parse(builder, stream, getPrecedence(NodeType::Add));
+}
+
+unique_ptr<NodeBase> parseExpressionMultiplication(const std::vector<Token>& tokens, unsigned int& pos) {
+    TreeBuilder builder;
+    VectorStream stream{tokens, pos};
+
+    return parse(builder, stream, getPrecedence(NodeType::Multiply));
+}
+
+unique_ptr<NodeBase> parseExpressionExponent(const std::vector<Token>& tokens, unsigned int& pos) {
+    TreeBuilder builder;
+    VectorStream stream{tokens, pos};
+
+    return parse(builder, stream, getPrecedence(NodeType::Exponent));
+}
+
+unique_ptr<NodeBase> parseExpressionVal(const std::vector<Token>& tokens, unsigned int& pos) {
+    TreeBuilder builder;
+    VectorStream stream{tokens, pos};
+
+    return parse(builder, stream, prefixPrecedence);
 }
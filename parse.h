@@ -1,9 +1,19 @@
 #pragma once
 
 #include "tree.h"
+#include "flat.h"
 #include "token.h"
 
+// all parse functions throw SyntaxError on malformed input
+
 std::unique_ptr<NodeBase> buildTree(const std::vector<Token>& tokens);
+FlatTree buildFlatTree(const std::vector<Token>& tokens);
+
+// tokenize on demand while parsing
+std::unique_ptr<NodeBase> buildTree(std::string_view expression);
+FlatTree buildFlatTree(std::string_view expression);
+
+// parse the longest prefix of tokens[pos..] matching one grammar rule, leaving pos after it
 
 std::unique_ptr<NodeBase> parseExpressionAddition(const std::vector<Token>& tokens, unsigned int& pos);
 std::unique_ptr<NodeBase> parseExpressionMultiplication(const std::vector<Token>& tokens, unsigned int& pos);
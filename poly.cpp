@@ -0,0 +1,519 @@
+#include "poly.h"
+#include "stack.h"
+
+#include <algorithm>
+#include <climits>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+using std::optional;
+using std::unique_ptr;
+using std::make_unique;
+
+namespace {
+
+const size_t termLimit = 4096; // larger results are left as trees
+const size_t maxProducts = 1 << 20; // term pairs in one multiplication
+
+// coefficients stay clear of INT_MIN so they can always be negated
+int add(int a, int b) {
+    int sum;
+
+    if (__builtin_add_overflow(a, b, &sum) || sum == INT_MIN) {
+        throw std::overflow_error("coefficient overflow");
+    }
+
+    return sum;
+}
+
+int multiply(int a, int b) {
+    int product;
+
+    if (__builtin_mul_overflow(a, b, &product) || product == INT_MIN) {
+        throw std::overflow_error("coefficient overflow");
+    }
+
+    return product;
+}
+
+unsigned int degree(const unsigned int* row, size_t width) {
+    unsigned int sum = 0;
+
+    for (size_t i = 0; i < width; ++i) {
+        sum += row[i];
+    }
+
+    return sum;
+}
+
+// true if a comes before b: higher degree first, then higher exponents of earlier symbols
+bool before(const unsigned int* a, const unsigned int* b, size_t width) {
+    unsigned int da = degree(a, width);
+    unsigned int db = degree(b, width);
+
+    return da != db ? da > db : std::lexicographical_compare(b, b + width, a, a + width);
+}
+
+unique_ptr<NodeBase> power(Symbol symbol, unsigned int e) {
+    if (e == 1) {
+        return make_unique<NodeVar>(symbol);
+    }
+
+    return make_unique<NodeExponent>(make_unique<NodeVar>(symbol), make_unique<NodeVal>(e));
+}
+
+}
+
+Polynomial::Polynomial(int constant) {
+    if (constant != 0) {
+        coeffs.push_back(constant);
+    }
+}
+
+Polynomial Polynomial::variable(Symbol symbol) {
+    Polynomial p;
+    p.symbols.push_back(symbol);
+    p.coeffs.push_back(1);
+    p.exponents.push_back(1);
+
+    return p;
+}
+
+optional<Polynomial> Polynomial::fromTree(const NodeBase& node, unsigned int maxTerms) {
+    checkStack();
+    NodeType type = node.getType();
+
+    switch (type) {
+        case NodeType::Val:
+            return Polynomial(static_cast<const NodeVal&>(node).val);
+        case NodeType::Var:
+            return variable(static_cast<const NodeVar&>(node).symbol);
+        case NodeType::AddInverse: {
+            optional<Polynomial> arg = fromTree(static_cast<const UnaryNodeBase&>(node).getArg(), maxTerms);
+            return arg ? apply(type, *arg, Polynomial(), maxTerms) : std::nullopt;
+        }
+        case NodeType::Sin:
+        case NodeType::Cos:
+        case NodeType::Exp:
+        case NodeType::Log:
+            return std::nullopt;
+        default: {
+            const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+            optional<Polynomial> left = fromTree(binary.getLeft(), maxTerms);
+
+            if (! left) {
+                return std::nullopt;
+            }
+
+            optional<Polynomial> right = fromTree(binary.getRight(), maxTerms);
+
+            return right ? apply(type, *left, *right, maxTerms) : std::nullopt;
+        }
+    }
+}
+
+unique_ptr<NodeBase> Polynomial::toTree(unique_ptr<NodeBase> sum) const {
+    if (coeffs.empty()) {
+        return sum == nullptr ? make_unique<NodeVal>(0) : std::move(sum);
+    }
+
+    size_t width = symbols.size();
+
+    for (size_t t = 0; t < coeffs.size(); ++t) {
+        const unsigned int* exps = row(t);
+        bool constant = degree(exps, width) == 0;
+        // the first term carries its own sign, later ones are added or subtracted
+        int coeff = sum == nullptr || coeffs[t] > 0 ? coeffs[t] : -coeffs[t];
+        unique_ptr<NodeBase> product;
+
+        if ((coeff != 1 && coeff != -1) || constant) {
+            product = make_unique<NodeVal>(coeff);
+        }
+
+        for (size_t i = 0; i < width; ++i) {
+            if (exps[i] == 0) {
+                continue;
+            }
+
+            unique_ptr<NodeBase> factor = power(symbols[i], exps[i]);
+            product = product == nullptr ? std::move(factor) : make_unique<NodeMultiply>(std::move(product), std::move(factor));
+        }
+
+        if (coeff == -1 && ! constant) {
+            product = make_unique<NodeAddInverse>(std::move(product));
+        }
+
+        if (sum == nullptr) {
+            sum = std::move(product);
+        } else if (coeffs[t] > 0) {
+            sum = make_unique<NodeAdd>(std::move(sum), std::move(product));
+        } else {
+            sum = make_unique<NodeSubtract>(std::move(sum), std::move(product));
+        }
+    }
+
+    return sum;
+}
+
+unsigned int Polynomial::nodeCount(bool appended) const {
+    if (coeffs.empty()) {
+        return appended ? 0 : 1;
+    }
+
+    unsigned int count = appended ? coeffs.size() : coeffs.size() - 1; // NodeAdd or NodeSubtract joining the terms
+
+    for (size_t t = 0; t < coeffs.size(); ++t) {
+        const unsigned int* exps = row(t);
+        unsigned int factors = 0;
+        unsigned int nodes = 0;
+
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            if (exps[i] > 0) {
+                ++factors;
+                nodes += exps[i] == 1 ? 1 : 3;
+            }
+        }
+
+        if ((coeffs[t] != 1 && coeffs[t] != -1) || factors == 0) {
+            ++factors;
+            ++nodes;
+        } else if (t == 0 && coeffs[t] == -1 && ! appended) {
+            ++nodes; // NodeAddInverse
+        }
+
+        count += nodes + factors - 1;
+    }
+
+    return count;
+}
+
+Polynomial Polynomial::operator-() const {
+    Polynomial result = *this;
+
+    for (int& coeff : result.coeffs) {
+        coeff = multiply(coeff, -1);
+    }
+
+    return result;
+}
+
+Polynomial Polynomial::operator+(const Polynomial& other) const {
+    Polynomial result;
+    std::set_union(symbols.begin(), symbols.end(), other.symbols.begin(), other.symbols.end(), std::back_inserter(result.symbols), symbolLess);
+
+    size_t width = result.symbols.size();
+    vector<unsigned int> scratchA;
+    vector<unsigned int> scratchB;
+    const unsigned int* a = align(result.symbols, scratchA);
+    const unsigned int* b = other.align(result.symbols, scratchB);
+    size_t m = coeffs.size();
+    size_t n = other.coeffs.size();
+    size_t i = 0;
+    size_t j = 0;
+
+    result.coeffs.reserve(m + n);
+    result.exponents.reserve((m + n) * width);
+
+    // merge the two sorted term lists
+    while (i < m || j < n) {
+        const unsigned int* x = a + i * width;
+        const unsigned int* y = b + j * width;
+
+        if (j == n || (i < m && before(x, y, width))) {
+            result.coeffs.push_back(coeffs[i++]);
+            result.exponents.insert(result.exponents.end(), x, x + width);
+        } else if (i == m || before(y, x, width)) {
+            result.coeffs.push_back(other.coeffs[j++]);
+            result.exponents.insert(result.exponents.end(), y, y + width);
+        } else {
+            int coeff = add(coeffs[i++], other.coeffs[j++]);
+
+            if (coeff != 0) {
+                result.coeffs.push_back(coeff);
+                result.exponents.insert(result.exponents.end(), x, x + width);
+            }
+        }
+    }
+
+    result.trim();
+
+    return result;
+}
+
+Polynomial Polynomial::operator-(const Polynomial& other) const {
+    return *this + -other;
+}
+
+Polynomial Polynomial::operator*(const Polynomial& other) const {
+    size_t m = coeffs.size();
+    size_t n = other.coeffs.size();
+
+    if (m * n > maxProducts) {
+        throw std::overflow_error("too many terms");
+    }
+
+    Polynomial products;
+    std::set_union(symbols.begin(), symbols.end(), other.symbols.begin(), other.symbols.end(), std::back_inserter(products.symbols), symbolLess);
+
+    size_t width = products.symbols.size();
+    vector<unsigned int> scratchA;
+    vector<unsigned int> scratchB;
+    const unsigned int* a = align(products.symbols, scratchA);
+    const unsigned int* b = other.align(products.symbols, scratchB);
+    products.coeffs.reserve(m * n);
+    products.exponents.reserve(m * n * width);
+
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            products.coeffs.push_back(multiply(coeffs[i], other.coeffs[j]));
+
+            for (size_t k = 0; k < width; ++k) {
+                unsigned int x = a[i * width + k];
+                unsigned int y = b[j * width + k];
+
+                if (y > INT_MAX - x) {
+                    throw std::overflow_error("exponent overflow");
+                }
+
+                products.exponents.push_back(x + y);
+            }
+        }
+    }
+
+    products.sort();
+
+    // combine like terms, which are now adjacent
+    Polynomial result;
+    result.symbols = products.symbols;
+    result.coeffs.reserve(products.coeffs.size());
+    result.exponents.reserve(products.exponents.size());
+
+    for (size_t t = 0; t < products.coeffs.size(); ++t) {
+        const unsigned int* exps = products.row(t);
+
+        if (! result.coeffs.empty() && std::equal(exps, exps + width, result.row(result.coeffs.size() - 1))) {
+            result.coeffs.back() = add(result.coeffs.back(), products.coeffs[t]);
+            continue;
+        }
+
+        result.dropZero();
+        result.coeffs.push_back(products.coeffs[t]);
+        result.exponents.insert(result.exponents.end(), exps, exps + width);
+    }
+
+    result.dropZero();
+    result.trim();
+
+    return result;
+}
+
+Polynomial Polynomial::pow(unsigned int n) const {
+    Polynomial result(1);
+    Polynomial base = *this;
+
+    // square and multiply
+    while (n > 0) {
+        if (n & 1) {
+            result = result * base;
+        }
+
+        n >>= 1;
+
+        if (n > 0) {
+            base = base * base;
+        }
+    }
+
+    return result;
+}
+
+Polynomial Polynomial::divide(int divisor) const {
+    Polynomial result = *this;
+
+    for (int& coeff : result.coeffs) {
+        if (divisor == 0 || coeff % divisor != 0) {
+            throw std::domain_error("inexact division");
+        }
+
+        coeff /= divisor;
+    }
+
+    return result;
+}
+
+Polynomial Polynomial::differentiate(Symbol wrt) const {
+    Polynomial result;
+    size_t k = std::find(symbols.begin(), symbols.end(), wrt) - symbols.begin();
+
+    if (k == symbols.size()) {
+        return result;
+    }
+
+    size_t width = symbols.size();
+    result.symbols = symbols;
+
+    for (size_t t = 0; t < coeffs.size(); ++t) {
+        const unsigned int* exps = row(t);
+
+        if (exps[k] > 0) {
+            result.coeffs.push_back(multiply(coeffs[t], exps[k]));
+            result.exponents.insert(result.exponents.end(), exps, exps + width);
+            --result.exponents[result.exponents.size() - width + k];
+        }
+    }
+
+    // lowering one exponent keeps terms distinct but can change their order
+    result.sort();
+    result.trim();
+
+    return result;
+}
+
+bool Polynomial::isConstant() const {
+    return symbols.empty();
+}
+
+int Polynomial::getConstant() const {
+    return coeffs.empty() ? 0 : coeffs[0];
+}
+
+bool Polynomial::isNegative() const {
+    return ! coeffs.empty() && coeffs[0] < 0;
+}
+
+unsigned int Polynomial::size() const {
+    return coeffs.size();
+}
+
+const unsigned int* Polynomial::row(size_t term) const {
+    return exponents.data() + term * symbols.size();
+}
+
+// exponent rows for symbols, which must include every symbol of this polynomial;
+// they are built in scratch unless the symbols are the same
+const unsigned int* Polynomial::align(const vector<Symbol>& symbols, vector<unsigned int>& scratch) const {
+    if (symbols == this->symbols) {
+        return exponents.data();
+    }
+
+    size_t width = symbols.size();
+    scratch.assign(coeffs.size() * width, 0);
+
+    for (size_t i = 0; i < this->symbols.size(); ++i) {
+        size_t position = std::find(symbols.begin(), symbols.end(), this->symbols[i]) - symbols.begin();
+
+        for (size_t t = 0; t < coeffs.size(); ++t) {
+            scratch[t * width + position] = row(t)[i];
+        }
+    }
+
+    return scratch.data();
+}
+
+// removes the last term if its coefficient cancelled out
+void Polynomial::dropZero() {
+    if (! coeffs.empty() && coeffs.back() == 0) {
+        coeffs.pop_back();
+        exponents.resize(exponents.size() - symbols.size());
+    }
+}
+
+// sorts an index rather than the rows, then gathers the rows in order
+void Polynomial::sort() {
+    size_t width = symbols.size();
+    vector<size_t> order(coeffs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y) { return before(row(x), row(y), width); });
+
+    vector<int> sortedCoeffs;
+    vector<unsigned int> sortedExponents;
+    sortedCoeffs.reserve(coeffs.size());
+    sortedExponents.reserve(exponents.size());
+
+    for (size_t t : order) {
+        sortedCoeffs.push_back(coeffs[t]);
+        sortedExponents.insert(sortedExponents.end(), row(t), row(t) + width);
+    }
+
+    coeffs = std::move(sortedCoeffs);
+    exponents = std::move(sortedExponents);
+}
+
+// drops symbols no term uses, which doesn't change the order of the terms
+void Polynomial::trim() {
+    size_t width = symbols.size();
+    string used(width, false);
+    size_t count = 0;
+
+    for (size_t t = 0; t < coeffs.size(); ++t) {
+        for (size_t i = 0; i < width; ++i) {
+            if (row(t)[i] > 0 && ! used[i]) {
+                used[i] = true;
+                ++count;
+            }
+        }
+    }
+
+    if (count == width) {
+        return;
+    }
+
+    vector<Symbol> kept;
+    vector<unsigned int> trimmed;
+    trimmed.reserve(coeffs.size() * count);
+
+    for (size_t i = 0; i < width; ++i) {
+        if (used[i]) {
+            kept.push_back(symbols[i]);
+        }
+    }
+
+    for (size_t t = 0; t < coeffs.size(); ++t) {
+        for (size_t i = 0; i < width; ++i) {
+            if (used[i]) {
+                trimmed.push_back(row(t)[i]);
+            }
+        }
+    }
+
+    symbols = std::move(kept);
+    exponents = std::move(trimmed);
+}
+
+optional<Polynomial> apply(NodeType type, const Polynomial& l, const Polynomial& r, unsigned int maxTerms) {
+    optional<Polynomial> result;
+
+    try {
+        switch (type) {
+            case NodeType::AddInverse: result = -l; break;
+            case NodeType::Add: result = l + r; break;
+            case NodeType::Subtract: result = l - r; break;
+            case NodeType::Multiply: result = l * r; break;
+            case NodeType::Divide:
+                if (r.isConstant()) {
+                    result = l.divide(r.getConstant());
+                }
+                break;
+            case NodeType::Exponent:
+                if (r.isConstant() && r.getConstant() >= 0) {
+                    result = l.pow(r.getConstant());
+                }
+                break;
+            default:
+                break;
+        }
+    } catch (const std::overflow_error&) {
+        return std::nullopt;
+    } catch (const std::domain_error&) {
+        return std::nullopt;
+    }
+
+    if (result && (result->size() > maxTerms || result->size() > termLimit)) {
+        return std::nullopt;
+    }
+
+    return result;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "tree.h"
+
+#include <climits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+/*
+Sparse multivariate polynomials with integer coefficients.
+Each term has a coefficient and a row of exponents, one for every symbol the
+polynomial uses; the rows are stored back to back in one array. Terms are
+sorted by total degree, then lexicographically by exponents (highest first),
+zero coefficients are dropped and unused symbols removed, so equal
+polynomials always have the same terms.
+Arithmetic throws std::overflow_error when a coefficient leaves the range of
+int or an expansion gets too large.
+*/
+class Polynomial {
+public:
+    Polynomial(int constant = 0);
+
+    static Polynomial variable(Symbol symbol);
+
+    // nullopt unless node is built from constants and variables with +, -, *, unary -,
+    // division by a constant that divides every coefficient and constant non-negative powers,
+    // or if a subtree's polynomial has more than maxTerms terms
+    static std::optional<Polynomial> fromTree(const NodeBase& node, unsigned int maxTerms = UINT_MAX);
+
+    // the terms added to or subtracted from sum one by one, or on their own if sum is null
+    std::unique_ptr<NodeBase> toTree(std::unique_ptr<NodeBase> sum = nullptr) const;
+
+    unsigned int nodeCount(bool appended = false) const; // nodes toTree() builds, not counting sum
+
+    Polynomial operator-() const;
+
+    Polynomial operator+(const Polynomial& other) const;
+
+    Polynomial operator-(const Polynomial& other) const;
+
+    Polynomial operator*(const Polynomial& other) const;
+
+    Polynomial pow(unsigned int n) const;
+
+    Polynomial divide(int divisor) const; // throws std::domain_error unless divisor divides every coefficient
+
+    Polynomial differentiate(Symbol wrt) const;
+
+    bool isConstant() const;
+
+    int getConstant() const; // the value of a constant polynomial
+
+    bool isNegative() const; // the first term's coefficient is negative
+
+    unsigned int size() const; // number of terms
+
+private:
+    const unsigned int* row(size_t term) const;
+
+    const unsigned int* align(const std::vector<Symbol>& symbols, std::vector<unsigned int>& scratch) const;
+
+    void dropZero();
+
+    void sort();
+
+    void trim();
+
+    std::vector<Symbol> symbols; // sorted by name
+    std::vector<int> coeffs; // one per term, never zero
+    std::vector<unsigned int> exponents; // symbols.size() per term
+};
+
+// the polynomial for type applied to its operands, nullopt if the result isn't one or is too large
+std::optional<Polynomial> apply(NodeType type, const Polynomial& l, const Polynomial& r, unsigned int maxTerms = UINT_MAX);
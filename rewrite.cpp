@@ -0,0 +1,913 @@
+#include "rewrite.h"
+#include "poly.h"
+#include "stack.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+using std::unique_ptr;
+using std::make_unique;
+using std::optional;
+using std::vector;
+
+namespace {
+
+using Slot = unique_ptr<NodeBase>;
+
+const unsigned int minCachedNodes = 4; // smaller trees aren't cached
+const unsigned int canonicalTag = UINT_MAX; // cache entries holding what expand() replaces a polynomial by, never a symbol
+
+bool isVal(const Slot& node) {
+    return node->getType() == NodeType::Val;
+}
+
+bool isVal(const Slot& node, int val) {
+    return isVal(node) && static_cast<const NodeVal&>(*node).val == val;
+}
+
+int& valOf(Slot& node) {
+    return static_cast<NodeVal&>(*node).val;
+}
+
+// folding stops short of INT_MIN, so every constant can also be negated
+bool fits(double val) {
+    return val >= -INT_MAX && val <= INT_MAX;
+}
+
+Slot& arg(Slot& node) {
+    return static_cast<UnaryNodeBase&>(*node).getArgPtr();
+}
+
+Slot& left(Slot& node) {
+    return static_cast<BinaryNodeBase&>(*node).getLeftPtr();
+}
+
+Slot& right(Slot& node) {
+    return static_cast<BinaryNodeBase&>(*node).getRightPtr();
+}
+
+// moves part out of node before node is destroyed, part must belong to node
+void replace(Slot& node, Slot& part) {
+    Slot keep = std::move(part);
+    node = std::move(keep);
+}
+
+// replaces node by its constant child, set to val
+void replaceVal(Slot& node, Slot& child, int val) {
+    valOf(child) = val;
+    replace(node, child);
+}
+
+// -(-x) -> x, -(c) -> (-c)
+bool negate(Slot& node) {
+    Slot& a = arg(node);
+
+    if (a->getType() == NodeType::AddInverse) {
+        replace(node, arg(a));
+    } else if (isVal(a)) {
+        replaceVal(node, a, -valOf(a));
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// sin(0) -> 0
+bool sinZero(Slot& node) {
+    Slot& a = arg(node);
+
+    if (isVal(a, 0)) {
+        replace(node, a);
+        return true;
+    }
+
+    return false;
+}
+
+// cos(0) -> 1, exp(0) -> 1
+bool zeroToOne(Slot& node) {
+    Slot& a = arg(node);
+
+    if (isVal(a, 0)) {
+        replaceVal(node, a, 1);
+        return true;
+    }
+
+    return false;
+}
+
+// log(1) -> 0
+bool logOne(Slot& node) {
+    Slot& a = arg(node);
+
+    if (isVal(a, 1)) {
+        replaceVal(node, a, 0);
+        return true;
+    }
+
+    return false;
+}
+
+// c op d -> e, where integer evaluation is exact
+bool fold(Slot& node) {
+    Slot& l = left(node);
+    Slot& r = right(node);
+
+    if (! isVal(l) || ! isVal(r)) {
+        return false;
+    }
+
+    double a = valOf(l);
+    double b = valOf(r);
+    double val;
+
+    switch (node->getType()) {
+        case NodeType::Add: val = a + b; break;
+        case NodeType::Subtract: val = a - b; break;
+        case NodeType::Multiply: val = a * b; break;
+        case NodeType::Divide: val = b == 0 ? NAN : a / b; break;
+        default: val = b < 0 ? NAN : pow(a, b); break;
+    }
+
+    if (! fits(val) || val != std::trunc(val)) {
+        return false;
+    }
+
+    replaceVal(node, l, val);
+
+    return true;
+}
+
+// 0+x -> x, x+0 -> x
+bool addZero(Slot& node) {
+    if (isVal(left(node), 0)) {
+        replace(node, right(node));
+    } else if (isVal(right(node), 0)) {
+        replace(node, left(node));
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// x+(-y) -> x-y, x+(-c) -> x-c
+bool addNegative(Slot& node) {
+    Slot& r = right(node);
+
+    if (r->getType() == NodeType::AddInverse) {
+        node = make_unique<NodeSubtract>(std::move(left(node)), std::move(arg(r)));
+    } else if (isVal(r) && valOf(r) < 0) {
+        valOf(r) = -valOf(r);
+        node = make_unique<NodeSubtract>(std::move(left(node)), std::move(r));
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// x-0 -> x, 0-x -> -x
+bool subtractZero(Slot& node) {
+    if (isVal(right(node), 0)) {
+        replace(node, left(node));
+    } else if (isVal(left(node), 0)) {
+        node = make_unique<NodeAddInverse>(std::move(right(node)));
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// x-(-y) -> x+y, x-(-c) -> x+c
+bool subtractNegative(Slot& node) {
+    Slot& r = right(node);
+
+    if (r->getType() == NodeType::AddInverse) {
+        node = make_unique<NodeAdd>(std::move(left(node)), std::move(arg(r)));
+    } else if (isVal(r) && valOf(r) < 0) {
+        valOf(r) = -valOf(r);
+        node = make_unique<NodeAdd>(std::move(left(node)), std::move(r));
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// 0*x -> 0, 1*x -> x, -1*x -> -x and the same with the constant on the right
+bool multiplyIdentity(Slot& node) {
+    for (int side = 0; side < 2; ++side) {
+        Slot& c = side == 0 ? left(node) : right(node);
+        Slot& x = side == 0 ? right(node) : left(node);
+
+        if (isVal(c, 0)) {
+            replace(node, c);
+        } else if (isVal(c, 1)) {
+            replace(node, x);
+        } else if (isVal(c, -1)) {
+            node = make_unique<NodeAddInverse>(std::move(x));
+        } else {
+            continue;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// a*(b*x) -> (a*b)*x, with either operand order at both levels
+bool multiplyConstants(Slot& node) {
+    for (int side = 0; side < 2; ++side) {
+        Slot& a = side == 0 ? left(node) : right(node);
+        Slot& product = side == 0 ? right(node) : left(node);
+
+        if (! isVal(a) || product->getType() != NodeType::Multiply) {
+            continue;
+        }
+
+        for (int inner = 0; inner < 2; ++inner) {
+            Slot& b = inner == 0 ? left(product) : right(product);
+            Slot& x = inner == 0 ? right(product) : left(product);
+
+            if (isVal(b) && fits(static_cast<double>(valOf(a)) * valOf(b))) {
+                valOf(a) *= valOf(b);
+                node = make_unique<NodeMultiply>(std::move(a), std::move(x));
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// 0/x -> 0, x/1 -> x, x/-1 -> -x
+bool divideIdentity(Slot& node) {
+    if (isVal(left(node), 0)) {
+        replace(node, left(node));
+    } else if (isVal(right(node), 1)) {
+        replace(node, left(node));
+    } else if (isVal(right(node), -1)) {
+        node = make_unique<NodeAddInverse>(std::move(left(node)));
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// c/d -> (c/g)/(d/g) with g the greatest common divisor, keeping the divisor positive
+bool divideCommonFactor(Slot& node) {
+    Slot& l = left(node);
+    Slot& r = right(node);
+
+    if (! isVal(l) || ! isVal(r) || valOf(r) == 0) {
+        return false;
+    }
+
+    int g = std::gcd(valOf(l), valOf(r));
+
+    if (valOf(r) < 0) {
+        g = -g;
+    }
+
+    if (g == 1) {
+        return false;
+    }
+
+    valOf(l) /= g;
+    valOf(r) /= g;
+
+    return true;
+}
+
+// 0^x -> 0, 1^x -> 1, x^0 -> 1, x^1 -> x
+bool exponentIdentity(Slot& node) {
+    if (isVal(left(node), 0) || isVal(left(node), 1)) {
+        replace(node, left(node));
+    } else if (isVal(right(node), 0)) {
+        replaceVal(node, right(node), 1);
+    } else if (isVal(right(node), 1)) {
+        replace(node, left(node));
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+struct Rule {
+    NodeType type;
+    bool (*apply)(Slot& node); // rewrites node and returns true if it matches
+};
+
+// tried in order, the first match wins
+const Rule rules[] = {
+    {NodeType::AddInverse, negate},
+    {NodeType::Sin, sinZero},
+    {NodeType::Cos, zeroToOne},
+    {NodeType::Exp, zeroToOne},
+    {NodeType::Log, logOne},
+    {NodeType::Add, fold},
+    {NodeType::Add, addZero},
+    {NodeType::Add, addNegative},
+    {NodeType::Subtract, fold},
+    {NodeType::Subtract, subtractZero},
+    {NodeType::Subtract, subtractNegative},
+    {NodeType::Multiply, fold},
+    {NodeType::Multiply, multiplyIdentity},
+    {NodeType::Multiply, multiplyConstants},
+    {NodeType::Divide, fold},
+    {NodeType::Divide, divideIdentity},
+    {NodeType::Divide, divideCommonFactor},
+    {NodeType::Exponent, fold},
+    {NodeType::Exponent, exponentIdentity},
+};
+
+bool applyRules(Slot& node, NodeType type) {
+    for (const Rule& rule : rules) {
+        if (rule.type == type && rule.apply(node)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// a rewrite may leave a new node in the slot whose children still need normalizing, so repeat until the slot is normalized;
+// returns true if any rule applied
+bool normalize(Slot& node, ForkJoinPool* pool) {
+    checkStack();
+    bool rewritten = false;
+
+    while (! node->isNormalized()) {
+        NodeType type = node->getType();
+
+        if (type == NodeType::Val || type == NodeType::Var) {
+            node->setNormalized(true);
+            break;
+        } else if (type >= NodeType::Add) {
+            bool l = false;
+            bool r = false;
+            forkJoin(pool, *left(node), *right(node),
+                     [&](ForkJoinPool* side) { l = normalize(left(node), side); },
+                     [&](ForkJoinPool* side) { r = normalize(right(node), side); });
+            rewritten = l || r || rewritten;
+        } else {
+            rewritten = normalize(arg(node), pool) || rewritten;
+        }
+
+        if (applyRules(node, type)) {
+            rewritten = true;
+        } else {
+            node->setNormalized(true);
+        }
+    }
+
+    return rewritten;
+}
+
+unsigned int countNodes(const NodeBase& node) {
+    checkStack();
+    NodeType type = node.getType();
+
+    if (type == NodeType::Val || type == NodeType::Var) {
+        return 1;
+    } else if (type >= NodeType::Add) {
+        const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+        return 1 + countNodes(binary.getLeft()) + countNodes(binary.getRight());
+    }
+
+    return 1 + countNodes(static_cast<const UnaryNodeBase&>(node).getArg());
+}
+
+// Polynomial::fromTree() may accept node, given its children are polynomials
+bool polynomialShape(Slot& node) {
+    switch (node->getType()) {
+        case NodeType::Val:
+        case NodeType::Var:
+        case NodeType::AddInverse:
+        case NodeType::Add:
+        case NodeType::Subtract:
+        case NodeType::Multiply:
+            return true;
+        case NodeType::Divide:
+            return isVal(right(node));
+        case NodeType::Exponent:
+            return isVal(right(node)) && valOf(right(node)) >= 0;
+        default:
+            return false;
+    }
+}
+
+struct Collected {
+    unsigned int size;
+    bool polynomial; // every node has polynomialShape()
+};
+
+Collected collect(Slot& node, bool& changed, TreeCache* cache, ForkJoinPool* pool);
+
+bool collectTerms(Slot& node, unsigned int size, TreeCache* cache, ForkJoinPool* pool);
+
+// replaces a polynomial subtree by its canonical form unless that is larger, returns true if the tree changed;
+// trees of one or two nodes are already canonical
+bool expand(Slot& node, unsigned int size, TreeCache* cache, ForkJoinPool* pool) {
+    checkStack();
+
+    if (size < 3) {
+        return false;
+    }
+
+    bool cached = cache != nullptr && size >= minCachedNodes;
+    size_t hash = cached ? TreeCache::hash(*node, canonicalTag) : 0;
+
+    if (cached) {
+        Slot tree = cache->find(*node, canonicalTag, hash);
+
+        if (tree != nullptr) {
+            if (tree->equals(*node)) {
+                return false;
+            }
+
+            node = std::move(tree);
+            return true;
+        }
+    }
+
+    // a polynomial with more terms than the tree has nodes can't be smaller, so it isn't built
+    optional<Polynomial> poly = Polynomial::fromTree(*node, size);
+
+    if (! poly) {
+        // an inexact division, overflow or a large expansion, smaller polynomials inside may still collect
+        bool changed = false;
+        NodeType type = node->getType();
+
+        if (type == NodeType::Add || type == NodeType::Subtract) {
+            changed = collectTerms(node, size, cache, pool);
+        } else if (type >= NodeType::Add) {
+            bool l = false;
+            bool r = false;
+            forkJoin(pool, *left(node), *right(node),
+                     [&](ForkJoinPool* side) { l = expand(left(node), collect(left(node), l, cache, side).size, cache, side) || l; },
+                     [&](ForkJoinPool* side) { r = expand(right(node), collect(right(node), r, cache, side).size, cache, side) || r; });
+            changed = l || r;
+        } else {
+            changed = expand(arg(node), collect(arg(node), changed, cache, pool).size, cache, pool) || changed;
+        }
+
+        if (changed) {
+            node->setNormalized(false);
+        }
+
+        return changed;
+    } else if (poly->nodeCount() > size) {
+        if (cached) {
+            cache->insert(*node, canonicalTag, hash, *node);
+        }
+
+        return false;
+    }
+
+    Slot tree = poly->toTree();
+
+    if (cached) {
+        cache->insert(*node, canonicalTag, hash, *tree);
+    }
+
+    if (poly->nodeCount() == size && tree->equals(*node)) {
+        return false;
+    }
+
+    node = std::move(tree);
+
+    return true;
+}
+
+// an operand of a chain of + and -
+struct Summand {
+    Slot* slot;
+    bool negative;
+    Collected collected;
+};
+
+// the operands of the chain of + and - rooted at node, each collected; chain holds the NodeAdd and NodeSubtract nodes
+void gather(Slot& node, bool negative, vector<Summand>& summands, vector<NodeBase*>& chain, bool& changed, TreeCache* cache,
+            ForkJoinPool* pool) {
+    checkStack();
+    NodeType type = node->getType();
+
+    if (type == NodeType::Add || type == NodeType::Subtract) {
+        chain.push_back(node.get());
+        bool rightNegative = type == NodeType::Subtract ? ! negative : negative;
+
+        Split split = pool != nullptr ? measure(*left(node), *right(node), forkNodes) : Split{false, false};
+
+        if (split.leftLarge && split.rightLarge) {
+            // the right side is gathered on its own and appended after the left, keeping the serial order
+            vector<Summand> rightSummands;
+            vector<NodeBase*> rightChain;
+            bool rightChanged = false;
+            pool->invoke([&] { gather(left(node), negative, summands, chain, changed, cache, pool); },
+                         [&] { gather(right(node), rightNegative, rightSummands, rightChain, rightChanged, cache, pool); });
+
+            summands.insert(summands.end(), rightSummands.begin(), rightSummands.end());
+            chain.insert(chain.end(), rightChain.begin(), rightChain.end());
+            changed = changed || rightChanged;
+        } else {
+            gather(left(node), negative, summands, chain, changed, cache, split.leftLarge ? pool : nullptr);
+            gather(right(node), rightNegative, summands, chain, changed, cache, split.rightLarge ? pool : nullptr);
+        }
+    } else {
+        Collected collected = collect(node, changed, cache, pool);
+        summands.push_back(Summand{&node, negative, collected});
+    }
+}
+
+// adds up the polynomial summands and moves them to the end of the sum, unless that makes it larger;
+// returns true if the tree changed
+bool collectSum(Slot& node, const vector<Summand>& summands, unsigned int size) {
+    Polynomial total;
+    vector<const Summand*> rest;
+    unsigned int restSize = 0;
+    unsigned int polynomials = 0;
+
+    for (const Summand& summand : summands) {
+        if (summand.collected.polynomial) {
+            optional<Polynomial> poly = Polynomial::fromTree(**summand.slot, size);
+            optional<Polynomial> sum = poly ? apply(summand.negative ? NodeType::Subtract : NodeType::Add, total, *poly) : std::nullopt;
+
+            if (sum) {
+                total = std::move(*sum);
+                ++polynomials;
+                continue;
+            }
+        }
+
+        rest.push_back(&summand);
+        restSize += summand.collected.size;
+    }
+
+    if (rest.empty()) {
+        return false;
+    }
+
+    // rebuilding has to make the sum smaller or combine terms, so a collected sum is left alone
+    unsigned int newSize = restSize + rest.size() - 1 + (rest[0]->negative ? 1 : 0) + total.nodeCount(true);
+
+    if (newSize > size || (newSize == size && polynomials <= total.size())) {
+        return false;
+    }
+
+    Slot sum = std::move(*rest[0]->slot);
+
+    if (rest[0]->negative) {
+        sum = make_unique<NodeAddInverse>(std::move(sum));
+    }
+
+    for (size_t i = 1; i < rest.size(); ++i) {
+        if (rest[i]->negative) {
+            sum = make_unique<NodeSubtract>(std::move(sum), std::move(*rest[i]->slot));
+        } else {
+            sum = make_unique<NodeAdd>(std::move(sum), std::move(*rest[i]->slot));
+        }
+    }
+
+    node = total.toTree(std::move(sum));
+
+    return true;
+}
+
+// collects like terms across a sum which isn't a polynomial as a whole, given its summands;
+// replaced tells whether anything below was already replaced, returns true if the tree changed
+bool collectTerms(Slot& node, const vector<Summand>& summands, const vector<NodeBase*>& chain, unsigned int size, bool replaced, TreeCache* cache,
+                  ForkJoinPool* pool) {
+    if (collectSum(node, summands, size)) {
+        return true;
+    }
+
+    for (const Summand& summand : summands) {
+        replaced = (summand.collected.polynomial && expand(*summand.slot, summand.collected.size, cache, pool)) || replaced;
+    }
+
+    if (replaced) {
+        for (NodeBase* link : chain) {
+            link->setNormalized(false);
+        }
+    }
+
+    return replaced;
+}
+
+bool collectTerms(Slot& node, unsigned int size, TreeCache* cache, ForkJoinPool* pool) {
+    vector<Summand> summands;
+    vector<NodeBase*> chain;
+    bool replaced = false;
+    gather(node, false, summands, chain, replaced, cache, pool);
+
+    return collectTerms(node, summands, chain, size, replaced, cache, pool);
+}
+
+// expands the largest polynomial subtrees below node, setting changed if any was replaced; node itself is left to the caller
+Collected collect(Slot& node, bool& changed, TreeCache* cache, ForkJoinPool* pool) {
+    checkStack();
+    NodeType type = node->getType();
+
+    if (type == NodeType::Val || type == NodeType::Var) {
+        return Collected{1, true};
+    } else if (type == NodeType::Add || type == NodeType::Subtract) {
+        vector<Summand> summands;
+        vector<NodeBase*> chain;
+        bool replaced = false;
+        gather(node, false, summands, chain, replaced, cache, pool);
+
+        Collected result{static_cast<unsigned int>(chain.size()), true};
+
+        for (const Summand& summand : summands) {
+            result.size += summand.collected.size;
+            result.polynomial = result.polynomial && summand.collected.polynomial;
+        }
+
+        if (! result.polynomial && collectTerms(node, summands, chain, result.size, replaced, cache, pool)) {
+            changed = true;
+        }
+
+        return result;
+    }
+
+    bool replaced = false;
+    Collected result{1, false};
+
+    if (type >= NodeType::Add) {
+        Collected l;
+        Collected r;
+        bool leftReplaced = false;
+        bool rightReplaced = false;
+        forkJoin(pool, *left(node), *right(node),
+                 [&](ForkJoinPool* side) { l = collect(left(node), leftReplaced, cache, side); },
+                 [&](ForkJoinPool* side) { r = collect(right(node), rightReplaced, cache, side); });
+        replaced = leftReplaced || rightReplaced;
+        result.size += l.size + r.size;
+        result.polynomial = l.polynomial && r.polynomial && polynomialShape(node);
+
+        if (! result.polynomial) {
+            replaced = (l.polynomial && expand(left(node), l.size, cache, pool)) || replaced;
+            replaced = (r.polynomial && expand(right(node), r.size, cache, pool)) || replaced;
+        }
+    } else {
+        Collected a = collect(arg(node), replaced, cache, pool);
+        result.size += a.size;
+        result.polynomial = a.polynomial && polynomialShape(node);
+
+        if (! result.polynomial) {
+            replaced = (a.polynomial && expand(arg(node), a.size, cache, pool)) || replaced;
+        }
+    }
+
+    // rules may match again once something below is replaced
+    if (replaced) {
+        changed = true;
+        node->setNormalized(false);
+    }
+
+    return result;
+}
+
+// a summand split into a constant coefficient and the product of its other factors
+struct Term {
+    double coefficient;
+    vector<const NodeBase*> factors; // in product order
+    size_t hash; // the same for equal factors in any order
+};
+
+void factorize(const NodeBase& node, Term& term) {
+    checkStack();
+    NodeType type = node.getType();
+
+    if (type == NodeType::Val) {
+        term.coefficient *= static_cast<const NodeVal&>(node).val;
+    } else if (type == NodeType::AddInverse) {
+        term.coefficient = -term.coefficient;
+        factorize(static_cast<const UnaryNodeBase&>(node).getArg(), term);
+    } else if (type == NodeType::Multiply) {
+        const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+        factorize(binary.getLeft(), term);
+        factorize(binary.getRight(), term);
+    } else {
+        term.factors.push_back(&node);
+        term.hash += node.hash();
+    }
+}
+
+// the same factors, in any order
+bool sameFactors(const Term& a, const Term& b) {
+    if (a.hash != b.hash || a.factors.size() != b.factors.size()) {
+        return false;
+    }
+
+    vector<bool> matched(b.factors.size(), false);
+
+    for (const NodeBase* factor : a.factors) {
+        size_t i = 0;
+
+        while (i < b.factors.size() && (matched[i] || ! factor->equals(*b.factors[i]))) {
+            ++i;
+        }
+
+        if (i == b.factors.size()) {
+            return false;
+        }
+
+        matched[i] = true;
+    }
+
+    return true;
+}
+
+void sumTerms(Slot& node, bool negative, vector<Term>& terms) {
+    checkStack();
+    NodeType type = node->getType();
+
+    if (type == NodeType::Add || type == NodeType::Subtract) {
+        sumTerms(left(node), negative, terms);
+        sumTerms(right(node), type == NodeType::Subtract ? ! negative : negative, terms);
+    } else {
+        Term term{negative ? -1.0 : 1.0, {}, 0};
+        factorize(*node, term);
+        terms.push_back(std::move(term));
+    }
+}
+
+// c*T + d*T becomes (c+d)*T across every sum, whatever else T is; the rules only do this for
+// polynomial terms, so other terms repeat, and their count doubles with every order of a product's derivative.
+// Returns true if the tree changed
+bool combineTerms(Slot& node) {
+    checkStack();
+    NodeType type = node->getType();
+    bool changed = false;
+
+    if (type != NodeType::Add && type != NodeType::Subtract) {
+        if (type >= NodeType::Add) {
+            changed = combineTerms(left(node)) || changed;
+            changed = combineTerms(right(node)) || changed;
+        } else if (type != NodeType::Val && type != NodeType::Var) {
+            changed = combineTerms(arg(node)) || changed;
+        }
+
+        if (changed) {
+            node->setNormalized(false);
+        }
+
+        return changed;
+    }
+
+    vector<Slot*> summands;
+    vector<Slot*> stack{&node};
+
+    // summands are combined inside first, they may be products of sums
+    while (! stack.empty()) {
+        Slot& slot = *stack.back();
+        stack.pop_back();
+
+        if (slot->getType() == NodeType::Add || slot->getType() == NodeType::Subtract) {
+            stack.push_back(&right(slot));
+            stack.push_back(&left(slot));
+        } else {
+            changed = combineTerms(slot) || changed;
+        }
+    }
+
+    vector<Term> terms;
+    sumTerms(node, false, terms);
+
+    // like terms, indexed by the first of them in terms
+    vector<Term*> groups;
+    std::unordered_map<size_t, vector<size_t>> byHash;
+    bool combined = false;
+
+    for (Term& term : terms) {
+        vector<size_t>& candidates = byHash[term.hash];
+        auto it = std::find_if(candidates.begin(), candidates.end(), [&](size_t i) { return sameFactors(*groups[i], term); });
+
+        if (it == candidates.end()) {
+            candidates.push_back(groups.size());
+            groups.push_back(&term);
+        } else {
+            groups[*it]->coefficient += term.coefficient;
+            combined = true;
+        }
+    }
+
+    if (! combined || ! std::all_of(groups.begin(), groups.end(), [](const Term* group) { return fits(group->coefficient); })) {
+        if (changed) {
+            node->setNormalized(false);
+        }
+
+        return changed;
+    }
+
+    Slot sum;
+
+    for (const Term* group : groups) {
+        if (group->coefficient == 0) {
+            continue;
+        }
+
+        int magnitude = static_cast<int>(std::abs(group->coefficient));
+        Slot product = group->factors.empty() || magnitude != 1 ? make_unique<NodeVal>(magnitude) : nullptr;
+
+        for (const NodeBase* factor : group->factors) {
+            product = product == nullptr ? factor->clone() : make_unique<NodeMultiply>(std::move(product), factor->clone());
+        }
+
+        if (sum == nullptr) {
+            sum = group->coefficient < 0 ? make_unique<NodeAddInverse>(std::move(product)) : std::move(product);
+        } else if (group->coefficient < 0) {
+            sum = make_unique<NodeSubtract>(std::move(sum), std::move(product));
+        } else {
+            sum = make_unique<NodeAdd>(std::move(sum), std::move(product));
+        }
+    }
+
+    node = sum == nullptr ? make_unique<NodeVal>(0) : std::move(sum);
+
+    return true;
+}
+
+// node has size nodes
+unique_ptr<NodeBase> simplifiedDerivative(const NodeBase& node, unsigned int size, Symbol wrt, TreeCache* cache, ForkJoinPool* pool) {
+    optional<Polynomial> poly = Polynomial::fromTree(node);
+
+    // an expanded polynomial is differentiated term by term, without building a derivative tree
+    if (poly && poly->nodeCount() <= size) {
+        return poly->differentiate(wrt).toTree();
+    }
+
+    return simplify(node.differentiate(wrt, cache, pool), cache, pool);
+}
+
+}
+
+unique_ptr<NodeBase> simplify(unique_ptr<NodeBase> node, TreeCache* cache, ForkJoinPool* pool) {
+    normalize(node, pool);
+
+    // collecting terms can let more rules apply, which can leave more terms to collect
+    for (;;) {
+        bool changed = false;
+        Collected collected = collect(node, changed, cache, pool);
+        changed = (collected.polynomial && expand(node, collected.size, cache, pool)) || changed;
+
+        if (! changed || ! normalize(node, pool)) {
+            break;
+        }
+    }
+
+    return node;
+}
+
+unique_ptr<NodeBase> derivative(const NodeBase& node, Symbol wrt, TreeCache* cache, ForkJoinPool* pool) {
+    unsigned int size = countNodes(node);
+
+    // small subtrees are cheaper to differentiate again than to look up
+    if (cache != nullptr && size >= minCachedNodes) {
+        size_t hash = TreeCache::hash(node, wrt);
+        unique_ptr<NodeBase> result = cache->find(node, wrt, hash);
+
+        if (result == nullptr) {
+            result = simplifiedDerivative(node, size, wrt, cache, pool);
+            cache->insert(node, wrt, hash, *result);
+        }
+
+        return result;
+    }
+
+    return simplifiedDerivative(node, size, wrt, nullptr, pool);
+}
+
+vector<PartialOrder> partialDerivative(const NodeBase& node, vector<Symbol> wrts, TreeCache* cache, ForkJoinPool* pool) {
+    std::stable_sort(wrts.begin(), wrts.end(), symbolLess);
+
+    vector<PartialOrder> orders;
+    orders.reserve(wrts.size());
+    const NodeBase* previous = &node;
+
+    for (Symbol wrt : wrts) {
+        unique_ptr<NodeBase> result = derivative(*previous, wrt, cache, pool);
+
+        if (combineTerms(result)) {
+            result = simplify(std::move(result), nullptr, pool);
+        }
+
+        unsigned int nodes = countNodes(*result);
+        orders.push_back(PartialOrder{wrt, std::move(result), nodes});
+        previous = orders.back().result.get();
+    }
+
+    return orders;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "tree.h"
+#include "cache.h"
+#include "parallel.h"
+
+#include <memory>
+#include <vector>
+
+/*
+Rule driven simplification of NodeBase trees.
+Each rule matches one node type and rewrites the node in place, reusing its
+children rather than copying them. Rules are applied bottom up until none
+matches; the node is then marked normalized so later passes skip it. Copies
+made by clone() aren't marked, except for constants and variables, so a
+simplified tree that is copied is normalized again.
+Afterwards like terms are collected: the largest polynomial subtrees are
+replaced by their canonical form (see poly.h) when that is no larger.
+Given a pool, both passes work on the two sides of a large binary node in
+parallel. The sides are disjoint subtrees and each keeps its own results until
+they are combined in serial order, so the result is the same as without one.
+*/
+
+// takes ownership of node and returns it simplified; with a cache, the canonical forms of
+// polynomial subtrees seen before are copied from it rather than rebuilt
+std::unique_ptr<NodeBase> simplify(std::unique_ptr<NodeBase> node, TreeCache* cache = nullptr, ForkJoinPool* pool = nullptr);
+
+// simplified derivative of node; with a cache, derivatives of subtrees seen before
+// are copied from it rather than recomputed
+std::unique_ptr<NodeBase> derivative(const NodeBase& node, Symbol wrt, TreeCache* cache = nullptr, ForkJoinPool* pool = nullptr);
+
+// one order of a higher-order or mixed partial derivative
+struct PartialOrder {
+    Symbol wrt; // the variable this order differentiates by
+    std::unique_ptr<NodeBase> result; // simplified
+    unsigned int nodes; // in result
+};
+
+// the partial derivative of node by each of wrts in turn, one PartialOrder per element, the last being the result;
+// every order is simplified before the next is taken, so swell doesn't compound from one order to the next.
+// The variables are taken in name order, which doesn't change the result, so d^3/dxdydx and d^3/dx^2dy are the
+// same derivatives in the cache and one reuses the lower orders of the other
+std::vector<PartialOrder> partialDerivative(const NodeBase& node, std::vector<Symbol> wrts, TreeCache* cache = nullptr,
+                                            ForkJoinPool* pool = nullptr);
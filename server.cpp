@@ -0,0 +1,487 @@
+#include "server.h"
+#include "tree.h"
+#include "token.h"
+#include "parse.h"
+#include "rewrite.h"
+#include "cache.h"
+#include "numeric.h"
+#include "tiered.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::string;
+using std::string_view;
+using std::shared_ptr;
+using std::vector;
+
+namespace {
+
+const size_t defaultCacheEntries = 1 << 16;
+const size_t maxRequestBytes = 1 << 20; // a longer line is refused and the connection closed
+const size_t maxPendingBytes = 1 << 20; // responses a client hasn't read yet before its requests are left unread
+const size_t readBytes = 1 << 16;
+const int maxEvents = 64;
+
+int stopFd = -1; // an eventfd every event loop watches, written on SIGINT and SIGTERM
+
+void requestStop(int) {
+    uint64_t one = 1;
+    ssize_t written = write(stopFd, &one, sizeof(one));
+    (void) written;
+}
+
+// parsed expressions by text, shared between threads; sharded and bounded like TreeCache
+class ExpressionCache {
+public:
+    ExpressionCache(size_t capacity, ExecutionManager& manager) : shardCapacity(std::max<size_t>(1, capacity / shardCount)), manager(manager) {
+    }
+
+    // throws SyntaxError if text doesn't parse
+    shared_ptr<TieredFunction> parse(const string& text) {
+        Shard& s = shards[std::hash<string>()(text) % shardCount];
+
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.trees.find(text);
+
+            if (it != s.trees.end()) {
+                return it->second;
+            }
+        }
+
+        shared_ptr<TieredFunction> tree = manager.make(buildTree(text));
+        shared_ptr<TieredFunction> old;
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto [it, inserted] = s.trees.try_emplace(text, tree);
+
+        if (! inserted) {
+            return it->second;
+        } else if (s.order.size() < shardCapacity) {
+            s.order.push_back(text);
+            return tree;
+        }
+
+        auto oldest = s.trees.find(s.order[s.next]);
+        old = std::move(oldest->second);
+        s.trees.erase(oldest);
+        s.order[s.next] = text;
+        s.next = (s.next + 1) % shardCapacity;
+
+        return tree;
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<string, shared_ptr<TieredFunction>> trees;
+        vector<string> order; // texts in insertion order, a ring once full
+        size_t next = 0;
+    };
+
+    static const size_t shardCount = 64;
+
+    size_t shardCapacity;
+    ExecutionManager& manager;
+    std::array<Shard, shardCount> shards;
+};
+
+// reads "<var>=<value>" pairs separated by spaces or commas into point, false if one is malformed
+bool parseBindings(string_view text, SymbolValues<double>& point) {
+    size_t start = 0;
+
+    while ((start = text.find_first_not_of(" ,", start)) != string_view::npos) {
+        size_t end = std::min(text.find_first_of(" ,", start), text.size());
+        string_view binding = text.substr(start, end - start);
+        size_t equals = binding.find('=');
+
+        if (equals == string_view::npos) {
+            return false;
+        }
+
+        string_view var = binding.substr(0, equals);
+        string_view digits = binding.substr(equals + 1);
+        Lexer lexer(var);
+        double val;
+        auto [last, error] = std::from_chars(digits.data(), digits.data() + digits.size(), val);
+
+        if (var.empty() || lexer.next().type != TokenType::Variable || lexer.peek().type != TokenType::End || digits.empty()
+            || error != std::errc() || last != digits.data() + digits.size()) {
+            return false;
+        }
+
+        point.slot(intern(var)) = val;
+        start = end;
+    }
+
+    return true;
+}
+
+struct Connection {
+    int fd;
+    string in; // received, not yet a whole request
+    string out; // responses not yet sent
+    bool ended = false; // the client sent everything it will send
+    bool failed = false; // close without sending the rest
+    unsigned int events = 0; // registered with epoll
+};
+
+class Server {
+public:
+    Server(const BatchOptions& options, int listenFd)
+        : listenFd(listenFd), numbers(options.numbers == NumberType::Int ? NumberType::Int64 : options.numbers),
+          expressions(options.cacheEntries > 0 ? options.cacheEntries : defaultCacheEntries, manager),
+          derivatives(options.cacheEntries > 0 ? options.cacheEntries : defaultCacheEntries) {
+    }
+
+    // one event loop, returns once stopFd is written
+    void serve() {
+        int epoll = epoll_create1(EPOLL_CLOEXEC);
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+        // every loop waits on the listening socket, EPOLLEXCLUSIVE wakes just one of them per client
+        watch(epoll, listenFd, EPOLLIN | EPOLLEXCLUSIVE, EPOLL_CTL_ADD);
+        watch(epoll, stopFd, EPOLLIN, EPOLL_CTL_ADD);
+
+        epoll_event events[maxEvents];
+        bool running = true;
+
+        while (running) {
+            int count = epoll_wait(epoll, events, maxEvents, -1);
+
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+
+                if (fd == stopFd) {
+                    running = false;
+                } else if (fd == listenFd) {
+                    accept(epoll, connections);
+                } else if (! handle(epoll, *connections[fd], events[i].events)) {
+                    close(fd);
+                    connections.erase(fd);
+                }
+            }
+        }
+
+        for (auto& [fd, connection] : connections) {
+            close(fd);
+        }
+
+        close(epoll);
+    }
+
+    size_t getHits() const {
+        return derivatives.getHits();
+    }
+
+    size_t getMisses() const {
+        return derivatives.getMisses();
+    }
+
+    size_t getPromotions() const {
+        return manager.getPromotions();
+    }
+
+private:
+    static void watch(int epoll, int fd, unsigned int events, int op) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epoll, op, fd, &event);
+    }
+
+    void accept(int epoll, std::unordered_map<int, std::unique_ptr<Connection>>& connections) {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (fd < 0) {
+                // EAGAIN once another loop has taken the client
+                return;
+            }
+
+            // responses are single small writes, which Nagle's algorithm would hold back over TCP
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            std::unique_ptr<Connection> connection = std::make_unique<Connection>();
+            connection->fd = fd;
+            connection->events = EPOLLIN;
+            watch(epoll, fd, EPOLLIN, EPOLL_CTL_ADD);
+            connections[fd] = std::move(connection);
+        }
+    }
+
+    // reads requests and sends responses as far as the socket allows, returns false once the connection is done
+    bool handle(int epoll, Connection& c, unsigned int events) {
+        if (events & EPOLLERR) {
+            return false;
+        }
+
+        char buffer[readBytes];
+
+        while (! c.ended && ! c.failed && c.out.size() < maxPendingBytes) {
+            ssize_t n = read(c.fd, buffer, sizeof(buffer));
+
+            if (n > 0) {
+                c.in.append(buffer, n);
+                respond(c);
+            } else if (n == 0) {
+                c.ended = true;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else {
+                return false;
+            }
+        }
+
+        // the response to a request without a final newline
+        if (c.ended && ! c.failed && ! c.in.empty()) {
+            c.in += '\n';
+            respond(c);
+        }
+
+        while (! c.out.empty()) {
+            ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+
+            if (n > 0) {
+                c.out.erase(0, n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                return false;
+            }
+        }
+
+        if (c.out.empty() && (c.ended || c.failed)) {
+            return false;
+        }
+
+        // wait for room to send, and stop reading while the client isn't reading its responses
+        unsigned int wanted = (c.out.empty() ? 0 : EPOLLOUT) | (c.ended || c.failed || c.out.size() >= maxPendingBytes ? 0 : EPOLLIN);
+
+        if (wanted != c.events) {
+            c.events = wanted;
+            watch(epoll, c.fd, wanted, EPOLL_CTL_MOD);
+        }
+
+        return true;
+    }
+
+    // answers every whole request in c.in
+    void respond(Connection& c) {
+        size_t start = 0;
+        size_t end;
+
+        while ((end = c.in.find('\n', start)) != string::npos) {
+            string_view request(c.in.data() + start, end - start);
+
+            if (! request.empty() && request.back() == '\r') {
+                request.remove_suffix(1);
+            }
+
+            answer(request, c.out);
+            c.out += '\n';
+            start = end + 1;
+        }
+
+        c.in.erase(0, start);
+
+        if (c.in.size() > maxRequestBytes) {
+            c.out += "error request too long\n";
+            c.in.clear();
+            c.failed = true;
+        }
+    }
+
+    void answer(string_view request, string& out) {
+        size_t space = request.find(' ');
+        string_view command = request.substr(0, space);
+        string_view rest = space == string_view::npos ? string_view() : request.substr(space + 1);
+        size_t size = out.size();
+
+        try {
+            if (command == "eval") {
+                SymbolValues<double> point;
+                size_t semicolon = rest.find(';');
+
+                if (semicolon != string_view::npos && ! parseBindings(rest.substr(0, semicolon), point)) {
+                    out += "error usage: eval [<var>=<value> ...;] <expression>";
+                    return;
+                } else if (semicolon != string_view::npos) {
+                    rest = rest.substr(std::min(rest.find_first_not_of(' ', semicolon + 1), rest.size()));
+                }
+
+                shared_ptr<TieredFunction> function = expressions.parse(string(rest));
+                out += "ok ";
+
+                // double is the type the compiled tier computes in, the others always walk the tree
+                if (numbers == NumberType::Double) {
+                    char digits[32];
+                    out.append(digits, std::to_chars(digits, digits + sizeof(digits), function->evaluate(point)).ptr);
+                } else {
+                    printValue(function->getTree(), numbers, point, out);
+                }
+            } else if (command == "diff") {
+                space = rest.find(' ');
+                string_view var = rest.substr(0, space);
+                Lexer lexer(var);
+
+                if (var.empty() || lexer.next().type != TokenType::Variable || lexer.peek().type != TokenType::End) {
+                    out += "error usage: diff <var> <expression>";
+                    return;
+                }
+
+                shared_ptr<TieredFunction> function = expressions.parse(string(space == string_view::npos ? string_view() : rest.substr(space + 1)));
+                Printer printer(out);
+                printer << "ok ";
+                derivative(function->getTree(), intern(var), &derivatives)->print(printer);
+            } else if (command == "simplify") {
+                shared_ptr<TieredFunction> function = expressions.parse(string(rest));
+                Printer printer(out);
+                printer << "ok ";
+                simplify(function->getTree().clone(), &derivatives)->print(printer);
+            } else {
+                out += "error unknown command, expected eval, diff or simplify";
+            }
+        } catch (const SyntaxError& e) {
+            out.resize(size);
+            out += "error at position " + std::to_string(e.getPos()) + ": " + e.what();
+        } catch (const std::exception& e) {
+            out.resize(size);
+            out += string("error ") + e.what();
+        }
+    }
+
+    int listenFd;
+    NumberType numbers;
+    ExecutionManager manager; // before expressions, which it outlives
+    ExpressionCache expressions;
+    TreeCache derivatives; // also holds the canonical forms of polynomials, see rewrite.h
+};
+
+// a listening socket for a Unix socket path, or a port on localhost if address is all digits; -1 after reporting an error
+int listenOn(const string& address) {
+    bool tcp = std::all_of(address.begin(), address.end(), isdigit);
+    unsigned int port = 0;
+
+    if (tcp) {
+        auto [end, error] = std::from_chars(address.data(), address.data() + address.size(), port);
+
+        if (error != std::errc() || end != address.data() + address.size() || port < 1 || port > 65535) {
+            std::cerr << "cas: not a port from 1 to 65535: " << address << std::endl;
+            return -1;
+        }
+    }
+
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int bound;
+
+    if (tcp) {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    } else {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+
+        if (address.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "cas: socket path too long: " << address << std::endl;
+            close(fd);
+            return -1;
+        }
+
+        // a socket left behind by an earlier server is replaced, any other file is not
+        struct stat info;
+
+        if (lstat(address.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(address.c_str());
+        }
+
+        std::strcpy(addr.sun_path, address.c_str());
+        bound = bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+
+    if (bound < 0 || listen(fd, SOMAXCONN) < 0) {
+        std::cerr << "cas: cannot listen on " << address << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+}
+
+int runServer(const BatchOptions& options) {
+    int listenFd = listenOn(options.serve);
+
+    if (listenFd < 0) {
+        return 1;
+    }
+
+    stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    struct sigaction action{};
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    Server server(options, listenFd);
+    vector<std::thread> loops;
+
+    for (unsigned int i = 1; i < std::max(1u, options.threads); ++i) {
+        loops.emplace_back(&Server::serve, &server);
+    }
+
+    std::cerr << "cas: serving on " << options.serve << std::endl;
+    server.serve();
+
+    for (std::thread& loop : loops) {
+        loop.join();
+    }
+
+    close(listenFd);
+    close(stopFd);
+
+    if (! std::all_of(options.serve.begin(), options.serve.end(), isdigit)) {
+        unlink(options.serve.c_str());
+    }
+
+    std::cerr << "cas: cache " << server.getHits() << " hits, " << server.getMisses() << " misses, "
+              << server.getPromotions() << " expressions compiled" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "batch.h"
+
+/*
+Long-running server answering requests over a Unix domain socket, or over TCP
+on localhost when options.serve is a port number, from 1 to 65535.
+Every line a client sends is one request and gets one response line, in
+order, so a client may pipeline any number of requests without waiting:
+    eval <expression>          ok <value in options.numbers>
+    eval x=1 y=2; <expression> the same with variables set, others are 0
+    diff <var> <expression>    ok <simplified derivative>
+    simplify <expression>      ok <simplified expression>
+A request that fails gets "error <message>" instead. int is evaluated as
+int64, so a division by zero is an error rather than the end of the server,
+and so is an expression nested too deeply for an event loop's stack, see
+stack.h.
+options.threads event loops share the listening socket; each serves the
+clients it accepts, handling a client's requests in order on one thread.
+Parsed expressions and derivatives are cached across all clients, with
+options.cacheEntries entries each or a default if that is 0. In double, an
+expression evaluated often is compiled in the background, see tiered.h.
+Runs until SIGINT or SIGTERM, then removes the socket file and reports cache
+hits and misses on stderr. Returns a process exit status.
+*/
+int runServer(const BatchOptions& options);
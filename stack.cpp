@@ -0,0 +1,42 @@
+#include "stack.h"
+
+#include <pthread.h>
+
+namespace {
+
+const uintptr_t stackReserve = 256 << 10; // left for the frames between checks and for unwinding
+
+thread_local bool stackKnown = false;
+
+}
+
+// above every address until the thread's stack is known, so its first check finds it
+constinit thread_local uintptr_t stackLimit = UINTPTR_MAX;
+
+DepthError::DepthError() : std::runtime_error("expression nested too deeply") {
+}
+
+void stackExhausted() {
+    if (! stackKnown) {
+        stackKnown = true;
+        stackLimit = 0; // no limit if the stack can't be found
+        pthread_attr_t attributes;
+
+        if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+            void* base;
+            size_t size;
+
+            if (pthread_attr_getstack(&attributes, &base, &size) == 0 && size > stackReserve) {
+                stackLimit = reinterpret_cast<uintptr_t>(base) + stackReserve;
+            }
+
+            pthread_attr_destroy(&attributes);
+        }
+
+        if (reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) >= stackLimit) {
+            return;
+        }
+    }
+
+    throw DepthError();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+
+/*
+Guard for the passes that still recurse over a tree, such as the simplifier,
+the evaluators and the compilers. The parser builds long sums and products
+balanced, but a chain of -, / or ^ is as deep as it is long, so each
+recursive step calls checkStack(), which throws DepthError once the calling
+thread is close to the end of its stack rather than letting it overflow.
+The reserve left when it throws covers the frames between two checks and
+unwinding. Works on any thread, whatever the size of its stack.
+*/
+
+class DepthError : public std::runtime_error {
+public:
+    DepthError();
+};
+
+// lowest frame address the calling thread may reach, set by stackExhausted() on the thread's first check
+extern constinit thread_local uintptr_t stackLimit;
+
+[[gnu::cold]] void stackExhausted(); // throws DepthError, unless this is the thread's first check and the stack has room
+
+inline void checkStack() {
+    if (reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) < stackLimit) {
+        stackExhausted();
+    }
+}
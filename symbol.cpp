@@ -0,0 +1,98 @@
+#include "symbol.h"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+using std::string;
+using std::string_view;
+
+namespace {
+
+const unsigned int blockBits = 10;
+const unsigned int blockSize = 1 << blockBits;
+const unsigned int blockCount = 1024; // room for a million names
+
+// names live in fixed blocks that never move, so they can be read without the lock
+struct Table {
+    ~Table() {
+        for (std::atomic<string*>& block : blocks) {
+            delete[] block.load();
+        }
+    }
+
+    Symbol intern(string_view name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = ids.find(name);
+
+        if (it != ids.end()) {
+            return it->second;
+        }
+
+        Symbol symbol = count.load(std::memory_order_relaxed);
+
+        if (symbol == blockSize * blockCount) {
+            throw std::length_error("too many variable names");
+        }
+
+        string* block = blocks[symbol >> blockBits].load(std::memory_order_relaxed);
+
+        if (block == nullptr) {
+            block = new string[blockSize];
+            blocks[symbol >> blockBits].store(block, std::memory_order_release);
+        }
+
+        string& stored = block[symbol & (blockSize - 1)];
+        stored = name;
+        ids.emplace(stored, symbol);
+        count.store(symbol + 1, std::memory_order_release);
+
+        return symbol;
+    }
+
+    const string& name(Symbol symbol) const {
+        return blocks[symbol >> blockBits].load(std::memory_order_acquire)[symbol & (blockSize - 1)];
+    }
+
+    std::mutex mutex;
+    std::unordered_map<string_view, Symbol> ids; // views of the names in blocks
+    std::array<std::atomic<string*>, blockCount> blocks{};
+    std::atomic<unsigned int> count{0};
+};
+
+Table& table() {
+    static Table instance;
+
+    return instance;
+}
+
+}
+
+Symbol intern(string_view name) {
+    // names seen by this thread before are found without taking the table's lock
+    thread_local std::unordered_map<string_view, Symbol> seen;
+    auto it = seen.find(name);
+
+    if (it != seen.end()) {
+        return it->second;
+    }
+
+    Symbol symbol = table().intern(name);
+    seen.emplace(symbolName(symbol), symbol);
+
+    return symbol;
+}
+
+const string& symbolName(Symbol symbol) {
+    return table().name(symbol);
+}
+
+unsigned int symbolCount() {
+    return table().count.load(std::memory_order_acquire);
+}
+
+bool symbolLess(Symbol a, Symbol b) {
+    return a != b && symbolName(a) < symbolName(b);
+}
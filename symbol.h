@@ -0,0 +1,62 @@
+#pragma once
+
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+Variable names interned to small integer ids.
+Each distinct name gets the next id the first time it is seen, so the ids in
+use are dense and values for variables can be kept in arrays indexed by id.
+The table is shared by the whole process and only grows: an id stays valid,
+and its name stays at the same address, for the life of the program. Threads
+may intern and look up names concurrently.
+*/
+
+using Symbol = unsigned int;
+
+Symbol intern(std::string_view name);
+
+const std::string& symbolName(Symbol symbol);
+
+unsigned int symbolCount(); // every id handed out so far is below this
+
+bool symbolLess(Symbol a, Symbol b); // orders by name, so the order doesn't depend on when names were interned
+
+// one value per symbol, indexed by id; symbols past the end read as T()
+template <typename T>
+class SymbolValues {
+public:
+    SymbolValues() = default;
+
+    SymbolValues(std::initializer_list<std::pair<std::string_view, T>> values) {
+        for (const auto& [name, val] : values) {
+            slot(intern(name)) = val;
+        }
+    }
+
+    T operator[](Symbol symbol) const {
+        return symbol < values.size() ? values[symbol] : T();
+    }
+
+    T& slot(Symbol symbol) { // grows the array to hold symbol
+        if (symbol >= values.size()) {
+            values.resize(symbol + 1, T());
+        }
+
+        return values[symbol];
+    }
+
+    const T* data() const {
+        return values.data();
+    }
+
+    unsigned int size() const {
+        return values.size();
+    }
+
+private:
+    std::vector<T> values;
+};
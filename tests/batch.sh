@@ -0,0 +1,58 @@
+#!/bin/sh
+# Checks that cas --batch answers every line in input order, errors included. Run from the repository root, after make.
+set -e
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# many more lines than fit in one chunk, on several threads, come out in order
+awk 'BEGIN { for (i = 1; i <= 20000; ++i) print i "*2+x" }' > "$dir/in"
+awk 'BEGIN { for (i = 1; i <= 20000; ++i) print i * 2 }' > "$dir/expected"
+
+for threads in 1 4 16; do
+    ./cas --batch "$dir/in" -j "$threads" -o "$dir/out"
+
+    if ! cmp -s "$dir/out" "$dir/expected"; then
+        echo "batch: -j $threads changed the order or the values" >&2
+        exit 1
+    fi
+done
+
+# a bad line gets an error on its own line and the lines after it still run; a blank line stays blank
+printf '1+2\n1/0\n2*(3\n\n7 $ 2\n2147483647+1\n-2147483647-1\n(0-2147483647-1)/(0-1)\n6/4\n' > "$dir/in"
+expected=$(cat <<'END'
+3
+error: division by zero
+error at position 2: unmatched '('
+
+error at position 2: unexpected character '$'
+-2147483648
+-2147483648
+-2147483648
+1
+END
+)
+
+for type in int int64; do
+    actual=$(./cas --batch "$dir/in" --type "$type" -j 4)
+    want=$expected
+
+    if [ "$type" = int64 ]; then
+        want=$(echo "$expected" | sed '6s/.*/2147483648/; 8s/.*/2147483648/')
+    fi
+
+    if [ "$actual" != "$want" ]; then
+        printf 'batch: --type %s gave\n%s\nexpected\n%s\n' "$type" "$actual" "$want" >&2
+        exit 1
+    fi
+done
+
+# malformed options are rejected before any work
+for args in "-j 0" "-j x" "--cache -1" "--type long" "--mode nope"; do
+    if ./cas --batch "$dir/in" $args > /dev/null 2>&1; then
+        echo "batch: accepted $args" >&2
+        exit 1
+    fi
+done
+
+echo "batch: ok"
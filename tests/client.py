@@ -0,0 +1,13 @@
+# Sends every line of a file at once on one connection to a cas --serve Unix socket and prints one response line per request.
+# Usage: python3 tests/client.py <socket> <requests>
+import socket
+import sys
+
+requests = open(sys.argv[2], "rb").read()
+client = socket.socket(socket.AF_UNIX)
+client.connect(sys.argv[1])
+client.sendall(requests)
+responses = client.makefile("rb")
+
+for _ in range(requests.count(b"\n")):
+    sys.stdout.buffer.write(responses.readline())
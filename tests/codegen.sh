@@ -0,0 +1,51 @@
+#!/bin/sh
+# Compiles code from cas --emit and checks what it computes. Run from the repository root, after make.
+set -e
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# check <expression> <arguments of f> <expected value>
+check() {
+    ./cas --emit "$1" > "$dir/f.c"
+    printf '#include <stdio.h>\ndouble f();\nint main(void) { printf("%%g\\n", f(%s)); return 0; }\n' "$2" > "$dir/main.c"
+    cc -std=c99 -Wall -Werror -o "$dir/f" "$dir/f.c" "$dir/main.c" -lm
+    c++ -x c++ -Wall -Werror -fsyntax-only "$dir/f.c"
+    actual=$("$dir/f")
+
+    if [ "$actual" != "$3" ]; then
+        echo "codegen: f($2) for $1 is $actual, expected $3" >&2
+        exit 1
+    fi
+}
+
+# a nested negation must not become the -- operator
+check "-(-x)*y" "5.0, 1.0" 5
+check "-(-(-x))" "2.0" -2
+check "y - -x" "2.0, 3.0" 5
+
+# variables named after keywords, alternative tokens and <math.h> macros are renamed
+check "or*not + catch*M_PI" "1.0, 2.0, 3.0, 4.0" 14
+check "__x*HUGE_VAL + FP_NAN" "1.0, 2.0, 3.0" 7
+
+# the loop form has restrict pointers in C and __restrict in C++
+./cas --emit "sin(x)*y" --d x --form loop --name grad > "$dir/loop.c"
+printf '#include <stdio.h>\n#include <stddef.h>\nvoid grad(size_t, const double*, const double*, double*, double*);\nint main(void) { double x[2] = {0, 1}, y[2] = {3, 4}, f[2], d[2]; grad(2, x, y, f, d); printf("%%g %%g\\n", f[1], d[0]); return 0; }\n' > "$dir/main.c"
+cc -std=c99 -pedantic -Wall -Werror -o "$dir/loop" "$dir/loop.c" "$dir/main.c" -lm
+c++ -x c++ -pedantic -Wall -Werror -fsyntax-only "$dir/loop.c"
+actual=$("$dir/loop")
+
+if [ "$actual" != "3.36588 3" ]; then
+    echo "codegen: loop form computes $actual, expected 3.36588 3" >&2
+    exit 1
+fi
+
+# the function can't be named after a keyword, a <math.h> name or a generated name, nor be reserved
+for name in int sin out t0 _f M_f 2f f-g; do
+    if ./cas --emit x --name "$name" > /dev/null 2>&1; then
+        echo "codegen: accepted --name $name" >&2
+        exit 1
+    fi
+done
+
+echo "codegen: ok"
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Checks that fingerprints tell equivalent expressions from different ones. Run from the repository root, after make.
+set -e
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# line <n>: the fingerprint printed for line n of $dir/in
+line() {
+    sed -n "$1p" "$dir/out"
+}
+
+printf '(x+1)^2\nx^2+2*x+1\nx^2+2*x+2\nx*y\ny*x\nx*y*z\n2*(3\n' > "$dir/in"
+./cas --batch "$dir/in" --mode fingerprint -o "$dir/out"
+
+if [ "$(line 1)" != "$(line 2)" ] || [ "$(line 4)" != "$(line 5)" ]; then
+    echo "fingerprint: equivalent expressions got different fingerprints" >&2
+    exit 1
+fi
+
+if [ "$(line 1)" = "$(line 3)" ] || [ "$(line 4)" = "$(line 6)" ]; then
+    echo "fingerprint: different expressions got the same fingerprint" >&2
+    exit 1
+fi
+
+if [ "$(line 7)" != "error at position 2: unmatched '('" ]; then
+    echo "fingerprint: a bad line gave $(line 7)" >&2
+    exit 1
+fi
+
+# the same on any number of threads
+./cas --batch "$dir/in" --mode fingerprint -j 4 -o "$dir/threads"
+
+if ! cmp -s "$dir/out" "$dir/threads"; then
+    echo "fingerprint: -j 4 changed the fingerprints" >&2
+    exit 1
+fi
+
+# /c at the prompt; identities of sin and cos are beyond the fingerprint, so it says it can't tell
+actual=$(printf '%s\n' '/c (x+1)^2 = x^2+2*x+1' '/c x*y = x+y' '/c sin(x)^2+cos(x)^2 = 1' '/c x' \
+    | ./cas | grep '^Equal,\|^Different,\|^Usage' | cut -d, -f1)
+
+expected='Equal
+Different
+Different
+Usage: /c <expression> = <expression>'
+
+if [ "$actual" != "$expected" ]; then
+    printf 'fingerprint: /c gave\n%s\nexpected\n%s\n' "$actual" "$expected" >&2
+    exit 1
+fi
+
+echo "fingerprint: ok"
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Checks the sparse Jacobian printed by cas --batch --mode jacobian. Run from the repository root, after make.
+set -e
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# variables in name order; a blank line is an empty row, and derivatives that simplify to 0 are left out
+printf 'x*y+z\nsin(x)\n\nx-x+y^2\n5\n' > "$dir/in"
+expected='jacobian 5 3 5
+variables x y z
+0 0 y
+0 1 x
+0 2 1
+1 0 cos(x)
+3 1 2*y'
+
+for threads in 1 4; do
+    actual=$(./cas --batch "$dir/in" --mode jacobian -j "$threads")
+
+    if [ "$actual" != "$expected" ]; then
+        printf 'jacobian: -j %s gave\n%s\nexpected\n%s\n' "$threads" "$actual" "$expected" >&2
+        exit 1
+    fi
+done
+
+# there is no row to put an error in, so a bad line fails the whole run and names the line
+printf 'x\nx*(\n' > "$dir/in"
+
+if ./cas --batch "$dir/in" --mode jacobian > /dev/null 2> "$dir/error"; then
+    echo "jacobian: accepted a bad line" >&2
+    exit 1
+fi
+
+if [ "$(cat "$dir/error")" != "cas: line 2: error at position 3: expected a value" ]; then
+    echo "jacobian: a bad line gave $(cat "$dir/error")" >&2
+    exit 1
+fi
+
+echo "jacobian: ok"
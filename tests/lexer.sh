@@ -0,0 +1,33 @@
+#!/bin/sh
+# Checks how cas reads numbers too large for a literal. Run from the repository root, after make.
+set -e
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# a literal past the int range is an error at its position, in every type, not a wrapped or saturated value
+printf '99999999999\n1+99999999999\n2147483648\n2147483647\n00002147483647\n' > "$dir/in"
+expected='error at position 0: number out of range
+error at position 2: number out of range
+error at position 0: number out of range
+2147483647
+2147483647'
+
+for type in double int int64; do
+    actual=$(./cas --batch "$dir/in" --type "$type")
+
+    if [ "$actual" != "$expected" ]; then
+        printf 'lexer: --type %s gave\n%s\nexpected\n%s\n' "$type" "$actual" "$expected" >&2
+        exit 1
+    fi
+done
+
+# the same error comes from the other modes
+actual=$(./cas --batch "$dir/in" --mode diff | head -1)
+
+if [ "$actual" != "error at position 0: number out of range" ]; then
+    echo "lexer: --mode diff gave $actual" >&2
+    exit 1
+fi
+
+echo "lexer: ok"
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Checks arithmetic in each --type, overflow included. Run from the repository root, after make.
+set -e
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# check <type> <expected output>, for the lines in $dir/in
+check() {
+    actual=$(./cas --batch "$dir/in" --type "$1")
+
+    if [ "$actual" != "$2" ]; then
+        printf 'numeric: --type %s gave\n%s\nexpected\n%s\n' "$1" "$actual" "$2" >&2
+        exit 1
+    fi
+}
+
+# integers wrap around on overflow, the minimum divided by -1 included, and only division by zero is an error
+printf '2147483647*2147483647*4\n2^63\n-(2^62)*2-1\n(0-2^63)/(0-1)\n(0-7)/2\n1/0\n' > "$dir/in"
+
+check int "4
+0
+-1
+0
+-3
+error: division by zero"
+
+check int64 "-17179869180
+-9223372036854775808
+9223372036854775807
+-9223372036854775808
+-3
+error: division by zero"
+
+# floating point types print at their own precision, and divide by zero without an error
+printf 'exp(1)\n1/0\nlog(0-1)\n' > "$dir/in"
+
+check float "2.7182817
+inf
+-nan"
+
+check double "2.718281828459045
+inf
+-nan"
+
+check complex "2.718281828459045+0i
+inf-nani
+0+3.141592653589793i"
+
+echo "numeric: ok"
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Parses very long and very deep expressions through cas --batch. Run from the repository root, after make.
+set -e
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# term <count> <first> <rest>: first followed by count - 1 copies of rest
+term() {
+    awk -v n="$1" -v first="$2" -v rest="$3" 'BEGIN { printf "%s", first; for (i = 1; i < n; ++i) printf "%s", rest; print "" }'
+}
+
+# wrap <count> <left> <inner> <right>
+wrap() {
+    awk -v n="$1" -v left="$2" -v inner="$3" -v right="$4" \
+        'BEGIN { for (i = 0; i < n; ++i) printf "%s", left; printf "%s", inner; for (i = 0; i < n; ++i) printf "%s", right; print "" }'
+}
+
+# check <mode> <expected output>, for the lines in $dir/in
+check() {
+    actual=$(./cas --batch "$dir/in" --mode "$1" | cut -c1-80)
+
+    if [ "$actual" != "$2" ]; then
+        printf 'parse: --mode %s gave\n%s\nexpected\n%s\n' "$1" "$actual" "$2" >&2
+        exit 1
+    fi
+}
+
+# long sums and products are built balanced, so they evaluate and differentiate at any length
+{
+    term 5000 1 +1
+    term 5000 x +x
+    term 100000 x '*x'
+    wrap 100000 '(' 7 ')'
+    wrap 1000001 - 1 ''
+    term 2000 1 -1
+} > "$dir/in"
+
+check eval "5000
+0
+0
+7
+-1
+-1998"
+
+check diff "0
+5000
+100000*x^99999
+0
+0
+0"
+
+# a chain of - is as deep as it is long; too deep a tree is an error on its line, and the lines after it still run
+{
+    term 1000000 x -x
+    wrap 1000000 'sin(' x ')'
+    echo 2-1
+} > "$dir/in"
+
+check eval "error: expression nested too deeply
+error: expression nested too deeply
+1"
+
+check diff "error: expression nested too deeply
+error: expression nested too deeply
+0"
+
+echo "parse: ok"
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Talks to cas --serve over a Unix socket and checks its answers. Run from the repository root, after make; needs python3.
+set -e
+
+dir=$(mktemp -d)
+server=
+trap '[ -n "$server" ] && kill "$server" 2> /dev/null; rm -rf "$dir"' EXIT
+
+./cas --serve "$dir/socket" 2> "$dir/log" &
+server=$!
+
+for i in $(seq 50); do
+    [ -S "$dir/socket" ] && break
+    sleep 0.1
+done
+
+# ask: prints the response to each line of $dir/requests, all sent at once on one connection
+ask() {
+    python3 tests/client.py "$dir/socket" "$dir/requests"
+}
+
+# check <expected responses>, for the requests in $dir/requests
+check() {
+    actual=$(ask)
+
+    if [ "$actual" != "$1" ]; then
+        printf 'server: got\n%s\nexpected\n%s\n' "$actual" "$1" >&2
+        exit 1
+    fi
+}
+
+# every command, its bindings, and a failed request answered in place without closing the connection
+printf 'eval 1+2\neval x=3 y=4; x*y+1\ndiff x x^3\nsimplify x+x+0\neval 1/0\neval 2*(3\nfrob 1\neval x=1; y\n' > "$dir/requests"
+
+check "ok 3
+ok 13
+ok 3*x^2
+ok 2*x
+error division by zero
+error at position 2: unmatched '('
+error unknown command, expected eval, diff or simplify
+ok 0"
+
+# pipelined requests are answered in order
+awk 'BEGIN { for (i = 1; i <= 5000; ++i) print "eval x=" i "; x*2" }' > "$dir/requests"
+awk 'BEGIN { for (i = 1; i <= 5000; ++i) print "ok " i * 2 }' > "$dir/expected"
+ask > "$dir/out"
+
+if ! cmp -s "$dir/out" "$dir/expected"; then
+    echo "server: pipelined responses out of order" >&2
+    exit 1
+fi
+
+# SIGTERM stops it cleanly
+kill -TERM "$server"
+status=0
+wait "$server" || status=$?
+server=
+
+if [ "$status" != 0 ]; then
+    echo "server: exited with status $status after SIGTERM" >&2
+    exit 1
+fi
+
+echo "server: ok"
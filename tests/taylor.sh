@@ -0,0 +1,25 @@
+#!/bin/sh
+# Checks the Taylor series mode of the cas prompt. Run from the repository root, after make.
+set -e
+
+# the series printed for each expression, and usage errors
+actual=$(printf '%s\n' \
+    '/s x 0' '/p x 4' 'exp(x)' 'exp(x)*sin(x)' '1/(1-x)' 'cos(x)^2+sin(x)^2' \
+    '/s x 1' 'x^3' 'log(x)' '/p x 2' '1/x' '/p x -1' \
+    | ./cas | grep '^= \|^Usage')
+
+expected='= 1 + 1*h + 0.5*h^2 + 0.166667*h^3 + 0.0416667*h^4, h = x - 0
+= 0 + 1*h + 1*h^2 + 0.333333*h^3 + 0*h^4, h = x - 0
+= 1 + 1*h + 1*h^2 + 1*h^3 + 1*h^4, h = x - 0
+= 1 + 0*h + 0*h^2 + 0*h^3 + 0*h^4, h = x - 0
+= 1 + 3*h + 3*h^2 + 1*h^3 + 0*h^4, h = x - 1
+= 0 + 1*h + -0.5*h^2 + 0.333333*h^3 + -0.25*h^4, h = x - 1
+= 1 + -1*h + 1*h^2, h = x - 1
+Usage: /p <wrt> [<order>]'
+
+if [ "$actual" != "$expected" ]; then
+    printf 'taylor: got\n%s\nexpected\n%s\n' "$actual" "$expected" >&2
+    exit 1
+fi
+
+echo "taylor: ok"
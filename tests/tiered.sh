@@ -0,0 +1,49 @@
+#!/bin/sh
+# Checks that cas --serve compiles an expression once it is hot, without changing its results. Run from the repository root, after make; needs python3.
+set -e
+
+dir=$(mktemp -d)
+server=
+trap '[ -n "$server" ] && kill "$server" 2> /dev/null; rm -rf "$dir"' EXIT
+
+./cas --serve "$dir/socket" --type double 2> "$dir/log" &
+server=$!
+
+for i in $(seq 50); do
+    [ -S "$dir/socket" ] && break
+    sleep 0.1
+done
+
+# one expression evaluated past the threshold of 32, and one that stays below it
+awk 'BEGIN {
+    for (i = 1; i <= 40; ++i) print "eval x=" i "; x/3+sin(x)*exp(0-x)"
+    for (i = 1; i <= 5; ++i) print "eval y+" i
+}' > "$dir/requests"
+
+python3 tests/client.py "$dir/socket" "$dir/requests" > "$dir/tree"
+
+if [ "$(head -1 "$dir/tree")" != "ok 0.6428932089864455" ] || [ "$(tail -1 "$dir/tree")" != "ok 5" ]; then
+    echo "tiered: wrong results before compiling" >&2
+    exit 1
+fi
+
+# the compiled form gives the same digits as the tree walk; compiling takes far less than the pause
+sleep 1
+python3 tests/client.py "$dir/socket" "$dir/requests" > "$dir/compiled"
+
+if ! cmp -s "$dir/tree" "$dir/compiled"; then
+    echo "tiered: compiling changed the results" >&2
+    diff "$dir/tree" "$dir/compiled" >&2 || true
+    exit 1
+fi
+
+kill -TERM "$server"
+wait "$server"
+server=
+
+if ! grep -q ' 1 expressions compiled$' "$dir/log"; then
+    echo "tiered: expected exactly one expression compiled, got: $(tail -1 "$dir/log")" >&2
+    exit 1
+fi
+
+echo "tiered: ok"
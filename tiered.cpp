@@ -0,0 +1,97 @@
+#include "tiered.h"
+#include "bytecode.h"
+#include "numeric.h"
+
+#include <algorithm>
+#include <vector>
+
+using std::shared_ptr;
+
+TieredFunction::TieredFunction(shared_ptr<const NodeBase> tree, ExecutionManager& manager)
+    : tree(std::move(tree)), manager(manager), calls(0), symbolBound(0), compiled(nullptr) {
+}
+
+const NodeBase& TieredFunction::getTree() const {
+    return *tree;
+}
+
+double TieredFunction::evaluate(const SymbolValues<double>& values) {
+    const NativeFunction* code = compiled.load(std::memory_order_acquire);
+
+    if (code == nullptr) {
+        // exactly one evaluation sees the threshold, so an expression is queued once
+        if (calls.fetch_add(1, std::memory_order_relaxed) + 1 == manager.promoteAfter) {
+            manager.promote(shared_from_this());
+        }
+
+        return evaluateAs(*tree, values);
+    } else if (values.size() >= symbolBound) {
+        return code->evaluate(values.data());
+    }
+
+    // the compiled code reads every symbol up to its bound, unset ones are 0 as in the tree
+    thread_local std::vector<double> vars;
+    vars.assign(symbolBound, 0);
+    std::copy(values.data(), values.data() + values.size(), vars.begin());
+
+    return code->evaluate(vars.data());
+}
+
+bool TieredFunction::isCompiled() const {
+    return compiled.load(std::memory_order_acquire) != nullptr;
+}
+
+ExecutionManager::ExecutionManager(unsigned int promoteAfter)
+    : promoteAfter(std::max(1u, promoteAfter)), stopping(false), promotions(0), thread(&ExecutionManager::compile, this) {
+}
+
+ExecutionManager::~ExecutionManager() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    available.notify_one();
+    thread.join();
+}
+
+shared_ptr<TieredFunction> ExecutionManager::make(shared_ptr<const NodeBase> tree) {
+    return std::make_shared<TieredFunction>(std::move(tree), *this);
+}
+
+size_t ExecutionManager::getPromotions() const {
+    return promotions.load();
+}
+
+void ExecutionManager::promote(shared_ptr<TieredFunction> function) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(function));
+    }
+
+    available.notify_one();
+}
+
+void ExecutionManager::compile() {
+    while (true) {
+        shared_ptr<TieredFunction> function;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this] { return ! queue.empty() || stopping; });
+
+            if (stopping) {
+                return;
+            }
+
+            function = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        Program program = Program::compile(*function->tree);
+        function->symbolBound = program.getSymbolBound();
+        function->native = std::make_unique<NativeFunction>(program);
+        function->compiled.store(function->native.get(), std::memory_order_release);
+        promotions.fetch_add(1);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "jit.h"
+#include "tree.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+Tiered evaluation for expressions that are parsed once and evaluated many
+times, in double precision.
+A cold expression is walked as a tree, which costs nothing up front. Its
+evaluations are counted, and the one that reaches the manager's threshold
+hands it to a background thread, which compiles it to a NativeFunction
+(native code, or bytecode where there is no JIT) and publishes that with a
+single atomic store. From then on every thread evaluates the compiled form;
+no caller ever waits for a compilation. Both tiers do the same double
+operations in the same order, so promotion doesn't change any result.
+*/
+
+class ExecutionManager;
+
+class TieredFunction : public std::enable_shared_from_this<TieredFunction> {
+public:
+    TieredFunction(std::shared_ptr<const NodeBase> tree, ExecutionManager& manager);
+
+    const NodeBase& getTree() const;
+
+    double evaluate(const SymbolValues<double>& values); // as evaluateAs<double>(), from any thread
+
+    bool isCompiled() const;
+
+private:
+    friend class ExecutionManager;
+
+    std::shared_ptr<const NodeBase> tree;
+    ExecutionManager& manager;
+    std::atomic<unsigned int> calls;
+    std::unique_ptr<NativeFunction> native; // written once by the compiler thread, before compiled
+    unsigned int symbolBound; // likewise
+    std::atomic<const NativeFunction*> compiled; // null while the tree is the fastest tier
+};
+
+class ExecutionManager {
+public:
+    explicit ExecutionManager(unsigned int promoteAfter = 32); // evaluations before an expression is compiled
+    ~ExecutionManager(); // compilations still queued are dropped
+
+    ExecutionManager(const ExecutionManager&) = delete;
+    ExecutionManager& operator=(const ExecutionManager&) = delete;
+
+    // the manager must outlive every function it makes
+    std::shared_ptr<TieredFunction> make(std::shared_ptr<const NodeBase> tree);
+
+    size_t getPromotions() const; // expressions compiled so far
+
+private:
+    friend class TieredFunction;
+
+    void promote(std::shared_ptr<TieredFunction> function);
+
+    void compile();
+
+    unsigned int promoteAfter;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<std::shared_ptr<TieredFunction>> queue; // keeps a function alive until it is compiled
+    bool stopping;
+    std::atomic<size_t> promotions;
+    std::thread thread;
+};
@@ -1,56 +1,113 @@
 #include "token.h"
-#include <unordered_set>
+
+#include <cctype>
+#include <climits>
 
 using std::vector;
 using std::string;
+using std::string_view;
 
-vector<Token> tokenize(const string& expression) {
-    vector<Token> tokens;
-    unsigned int pos = 0;
-
-    const std::unordered_set<string> functions = {"sin", "cos", "exp", "log"};
-
-    while (pos < expression.length()) {
-        char c = expression[pos];
-        
-        if (isdigit(c)) {
-            int num = 0;
-            while (pos < expression.length() && isdigit(expression[pos])) {
-                num = num * 10 + (expression[pos] - '0');
-                ++pos;
-            }
-            tokens.push_back(Token{TokenType::Number, num, ""});
-        } else if (isalpha(c)) {
-            string id;
-            while (pos < expression.length() && isalpha(expression[pos])) {
-                id += expression[pos];
-                ++pos;
-            }
+namespace {
 
-            if (functions.find(id) != functions.end()) {
-                tokens.push_back(Token{TokenType::Function, 0, id});
-            } else {
-                tokens.push_back(Token{TokenType::Variable, 0, id});
-            }
-        } else {
-            if (c == '+') {
-                tokens.push_back(Token{TokenType::Add, 0, ""});
-            } else if (c == '-') {
-                tokens.push_back(Token{TokenType::Subtract, 0, ""});
-            } else if (c == '*') {
-                tokens.push_back(Token{TokenType::Multiply, 0, ""});
-            } else if (c == '/') {
-                tokens.push_back(Token{TokenType::Divide, 0, ""});
-            } else if (c == '^') {
-                tokens.push_back(Token{TokenType::Exponent, 0, ""});
-            } else if (c == '(') {
-                tokens.push_back(Token{TokenType::OpenParentheses, 0, ""});
-            } else if (c == ')') {
-                tokens.push_back(Token{TokenType::CloseParentheses, 0, ""});
+constexpr string_view functions[] = {"sin", "cos", "exp", "log"};
+
+constexpr bool isFunction(string_view id) {
+    for (string_view function : functions) {
+        if (function == id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static_assert(isFunction("sin") && ! isFunction("x"));
+
+}
+
+SyntaxError::SyntaxError(const string& message, unsigned int pos) : std::runtime_error(message), pos(pos) {
+}
+
+unsigned int SyntaxError::getPos() const {
+    return pos;
+}
+
+Lexer::Lexer(string_view input) : input(input), pos(0) {
+    current = lex();
+}
+
+const Token& Lexer::peek() const {
+    return current;
+}
+
+Token Lexer::next() {
+    Token token = current;
+
+    if (token.type != TokenType::End) {
+        current = lex();
+    }
+
+    return token;
+}
+
+Token Lexer::lex() {
+    while (pos < input.length() && isspace(static_cast<unsigned char>(input[pos]))) {
+        ++pos;
+    }
+
+    unsigned int start = pos;
+
+    if (pos == input.length()) {
+        return Token{TokenType::End, 0, {}, start};
+    }
+
+    char c = input[pos];
+
+    if (isdigit(static_cast<unsigned char>(c))) {
+        int num = 0;
+        while (pos < input.length() && isdigit(static_cast<unsigned char>(input[pos]))) {
+            int digit = input[pos] - '0';
+
+            if (num > (INT_MAX - digit) / 10) {
+                throw SyntaxError("number out of range", start);
             }
 
+            num = num * 10 + digit;
             ++pos;
         }
+
+        return Token{TokenType::Number, num, {}, start};
+    } else if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+        // identifiers may continue with digits, so x1 is a name rather than x followed by 1
+        while (pos < input.length() && (isalnum(static_cast<unsigned char>(input[pos])) || input[pos] == '_')) {
+            ++pos;
+        }
+
+        string_view id = input.substr(start, pos - start);
+
+        return Token{isFunction(id) ? TokenType::Function : TokenType::Variable, 0, id, start};
+    }
+
+    ++pos;
+
+    switch (c) {
+        case '+': return Token{TokenType::Add, 0, {}, start};
+        case '-': return Token{TokenType::Subtract, 0, {}, start};
+        case '*': return Token{TokenType::Multiply, 0, {}, start};
+        case '/': return Token{TokenType::Divide, 0, {}, start};
+        case '^': return Token{TokenType::Exponent, 0, {}, start};
+        case '(': return Token{TokenType::OpenParentheses, 0, {}, start};
+        case ')': return Token{TokenType::CloseParentheses, 0, {}, start};
+        default: throw SyntaxError(string("unexpected character '") + c + "'", start);
+    }
+}
+
+vector<Token> tokenize(string_view expression) {
+    vector<Token> tokens;
+    Lexer lexer(expression);
+
+    while (lexer.peek().type != TokenType::End) {
+        tokens.push_back(lexer.next());
     }
 
     return tokens;
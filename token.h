@@ -1,14 +1,45 @@
 #pragma once
 
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-enum class TokenType {Number, Add, Subtract, Multiply, Divide, Exponent, OpenParentheses, CloseParentheses, Variable, Function};
+enum class TokenType {Number, Add, Subtract, Multiply, Divide, Exponent, OpenParentheses, CloseParentheses, Variable, Function, End};
 
+// tokens view the input text, which must outlive them
 struct Token {
     TokenType type;
-    int val; // if type is TokenType::Number
-    std::string name; // if type is TokenType::Variable or TokenType::Function
+    int val; // if type is TokenType::Number, at most INT_MAX; a larger number is a SyntaxError
+    std::string_view name; // if type is TokenType::Variable or TokenType::Function
+    unsigned int pos; // offset of the token in the input
 };
 
-std::vector<Token> tokenize(const std::string& expression);
+class SyntaxError : public std::runtime_error {
+public:
+    SyntaxError(const std::string& message, unsigned int pos);
+
+    unsigned int getPos() const;
+
+private:
+    unsigned int pos;
+};
+
+// pulls tokens from the input on demand, TokenType::End once the input is exhausted
+class Lexer {
+public:
+    Lexer(std::string_view input);
+
+    const Token& peek() const;
+
+    Token next();
+
+private:
+    Token lex();
+
+    std::string_view input;
+    unsigned int pos;
+    Token current;
+};
+
+std::vector<Token> tokenize(std::string_view expression);
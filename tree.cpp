@@ -1,7 +1,13 @@
 #include "tree.h"
+#include "parallel.h"
+#include "rewrite.h"
+#include "stack.h"
 
 #include <iostream> // debug
+#include <array>
+#include <charconv>
 #include <cmath>
+#include <vector>
 
 const int valPrecedence = 5; // NodeVal, NodeVar
 const int unaryPrecedence = 4; // functions, NodeAddInverse
@@ -9,521 +15,723 @@ const int exponentPrecedence = 3; // NodeExponent
 const int multiplyPrecedence = 2; // NodeMultiply, NodeDivide
 const int addPrecedence = 1; // NodeAdd, NodeSubtract
 
+const size_t printChunk = 1 << 16; // bytes buffered before a Printer writes to its stream
+const size_t maxSharedNodes = 256; // larger function arguments and divisors are differentiated in place
+
 using std::string;
 using std::unique_ptr;
 using std::make_unique;
 
-NodeBase::NodeBase(int precedence) : precedence(precedence) {
-}
+namespace {
 
-int NodeBase::getPrecedence() const {
-    return precedence;
-}
+// subtrees waiting to be freed, so destroying a deep tree doesn't recurse once per level
+thread_local std::vector<unique_ptr<NodeBase>> doomed;
+thread_local bool draining = false;
 
-UnaryNodeBase::UnaryNodeBase(unique_ptr<NodeBase> arg, int precedence)
-    : NodeBase(precedence), arg(std::move(arg)) {
-}
+void dispose(unique_ptr<NodeBase>& child) {
+    if (child == nullptr || child->getType() == NodeType::Val || child->getType() == NodeType::Var) {
+        return;
+    }
 
-BinaryNodeBase::BinaryNodeBase(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right, int precedence)
-    : NodeBase(precedence), left(std::move(left)), right(std::move(right)) {
-}
+    doomed.push_back(std::move(child));
 
-NodeVal::NodeVal(int val) : NodeBase(valPrecedence), val(val) {
-}
+    if (draining) {
+        return;
+    }
 
-int NodeVal::evaluate() const {
-    return val;
-}
+    draining = true;
 
-string NodeVal::toString() const {
-    return std::to_string(val);
-}
+    while (! doomed.empty()) {
+        unique_ptr<NodeBase> node = std::move(doomed.back());
+        doomed.pop_back();
+        node.reset(); // queues the node's own children
+    }
 
-unique_ptr<NodeBase> NodeVal::clone() const {
-    return make_unique<NodeVal>(*this);
+    draining = false;
 }
 
-unique_ptr<NodeBase> NodeVal::differentiate(char wrt) const {
-    return make_unique<NodeVal>(0);
-}
+// function arguments and divisors are what repeats across expressions, so with a cache the derivatives of small ones
+// are simplified and shared through it; other children are differentiated in place. A large child would be hashed,
+// simplified and copied into the cache once for every function or divisor it is nested in
+bool shared(const NodeBase& child, TreeCache* cache) {
+    if (cache == nullptr) {
+        return false;
+    }
 
-unique_ptr<NodeBase> NodeVal::simplify() const {
-    return make_unique<NodeVal>(val);
-}
+    // counts no further than maxSharedNodes; every node visited adds at most one to the stack
+    std::array<const NodeBase*, maxSharedNodes + 2> stack;
+    size_t top = 0;
+    size_t count = 0;
+    stack[top++] = &child;
+
+    while (top > 0) {
+        if (++count > maxSharedNodes) {
+            return false;
+        }
+
+        const NodeBase* next = stack[--top];
+
+        if (next->getType() >= NodeType::Add) {
+            stack[top++] = &static_cast<const BinaryNodeBase*>(next)->getRight();
+            stack[top++] = &static_cast<const BinaryNodeBase*>(next)->getLeft();
+        } else if (next->getType() != NodeType::Val && next->getType() != NodeType::Var) {
+            stack[top++] = &static_cast<const UnaryNodeBase*>(next)->getArg();
+        }
+    }
 
-NodeVar::NodeVar(char symbol)
-    : NodeBase(valPrecedence), symbol(symbol) {
+    return true;
 }
 
-int NodeVar::evaluate() const {
-    return 0;
+unique_ptr<NodeBase> sharedDerivative(const NodeBase& child, Symbol wrt, TreeCache* cache, ForkJoinPool* pool) {
+    return shared(child, cache) ? derivative(child, wrt, cache, pool) : child.differentiate(wrt, cache, pool);
 }
 
-string NodeVar::toString() const {
-    return string(1, symbol);
-}
+// the derivative of node given those of its operands, l for the first and r for the second of a binary node;
+// an exponent is a constant, so r is unused there
+unique_ptr<NodeBase> chainRule(const NodeBase& node, Symbol wrt, unique_ptr<NodeBase> l, unique_ptr<NodeBase> r) {
+    switch (node.getType()) {
+        case NodeType::Val:
+            return make_unique<NodeVal>(0);
+        case NodeType::Var:
+            return make_unique<NodeVal>(static_cast<const NodeVar&>(node).symbol == wrt ? 1 : 0);
+        case NodeType::AddInverse:
+            return make_unique<NodeAddInverse>(std::move(l));
+        default:
+            break;
+    }
 
-unique_ptr<NodeBase> NodeVar::clone() const {
-    return make_unique<NodeVar>(*this);
-}
+    if (node.getType() < NodeType::Add) {
+        const NodeBase& arg = static_cast<const UnaryNodeBase&>(node).getArg();
+
+        switch (node.getType()) {
+            case NodeType::Sin:
+                return make_unique<NodeMultiply>(std::move(l), make_unique<NodeCos>(arg.clone()));
+            case NodeType::Cos:
+                return make_unique<NodeMultiply>(make_unique<NodeAddInverse>(std::move(l)), make_unique<NodeSin>(arg.clone()));
+            case NodeType::Exp:
+                return make_unique<NodeMultiply>(std::move(l), make_unique<NodeExp>(arg.clone()));
+            default:
+                return make_unique<NodeDivide>(std::move(l), arg.clone());
+        }
+    }
 
-unique_ptr<NodeBase> NodeVar::differentiate(char wrt) const {
-    return symbol == wrt ? make_unique<NodeVal>(1) : make_unique<NodeVal>(0);
+    const NodeBase& left = static_cast<const BinaryNodeBase&>(node).getLeft();
+    const NodeBase& right = static_cast<const BinaryNodeBase&>(node).getRight();
+
+    switch (node.getType()) {
+        case NodeType::Add:
+            return make_unique<NodeAdd>(std::move(l), std::move(r));
+        case NodeType::Subtract:
+            return make_unique<NodeSubtract>(std::move(l), std::move(r));
+        case NodeType::Multiply:
+            return make_unique<NodeAdd>(make_unique<NodeMultiply>(std::move(l), right.clone()), make_unique<NodeMultiply>(left.clone(), std::move(r)));
+        case NodeType::Divide:
+            return make_unique<NodeDivide>(make_unique<NodeSubtract>(make_unique<NodeMultiply>(std::move(l), right.clone()),
+                                                                     make_unique<NodeMultiply>(std::move(r), left.clone())),
+                                           make_unique<NodeExponent>(right.clone(), make_unique<NodeVal>(2)));
+        default:
+            // power rule
+            return make_unique<NodeMultiply>(std::move(l),
+                                            make_unique<NodeMultiply>(make_unique<NodeVal>(right.evaluate()),
+                                                                      make_unique<NodeExponent>(left.clone(), make_unique<NodeVal>(right.evaluate() - 1))));
+    }
 }
 
-unique_ptr<NodeBase> NodeVar::simplify() const {
-    return make_unique<NodeVar>(symbol);
+// the derivative of a binary node whose operands are both large, differentiated concurrently;
+// each side builds its own term of a product or quotient, so the clones are split between the threads too
+unique_ptr<NodeBase> forkedDerivative(const BinaryNodeBase& node, Symbol wrt, TreeCache* cache, ForkJoinPool* pool) {
+    const NodeBase& left = node.getLeft();
+    const NodeBase& right = node.getRight();
+    unique_ptr<NodeBase> l;
+    unique_ptr<NodeBase> r;
+
+    switch (node.getType()) {
+        case NodeType::Multiply:
+            pool->invoke([&] { l = make_unique<NodeMultiply>(left.differentiate(wrt, cache, pool), right.clone()); },
+                         [&] { r = make_unique<NodeMultiply>(left.clone(), right.differentiate(wrt, cache, pool)); });
+            return make_unique<NodeAdd>(std::move(l), std::move(r));
+        case NodeType::Divide:
+            pool->invoke([&] { l = make_unique<NodeMultiply>(left.differentiate(wrt, cache, pool), right.clone()); },
+                         [&] { r = make_unique<NodeMultiply>(sharedDerivative(right, wrt, cache, pool), left.clone()); });
+            return make_unique<NodeDivide>(make_unique<NodeSubtract>(std::move(l), std::move(r)),
+                                           make_unique<NodeExponent>(right.clone(), make_unique<NodeVal>(2)));
+        default:
+            pool->invoke([&] { l = left.differentiate(wrt, cache, pool); }, [&] { r = right.differentiate(wrt, cache, pool); });
+            return chainRule(node, wrt, std::move(l), std::move(r));
+    }
 }
 
-NodeAddInverse::NodeAddInverse(unique_ptr<NodeBase> arg)
-    : UnaryNodeBase(std::move(arg), unaryPrecedence) {
-}
+size_t mix(size_t h, unsigned long long v) {
+    h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
 
-int NodeAddInverse::evaluate() const {
-    return -1 * arg->evaluate();
+    return h;
 }
 
-string NodeAddInverse::toString() const {
-    if (precedence > arg->getPrecedence()) {
-        return "-(" + arg->toString() + ")";
-    } else {
-        return "-" + arg->toString();
-    }
 }
 
-unique_ptr<NodeBase> NodeAddInverse::clone() const {
-    return make_unique<NodeAddInverse>(arg->clone());
+Printer::Printer(string& out, std::ostream* stream) : out(out), stream(stream) {
 }
 
-unique_ptr<NodeBase> NodeAddInverse::differentiate(char wrt) const {
-    return make_unique<NodeAddInverse>(arg->differentiate(wrt));
-}
+Printer& Printer::operator<<(char c) {
+    out += c;
+    spill();
 
-unique_ptr<NodeBase> NodeAddInverse::simplify() const {
-    return make_unique<NodeAddInverse>(arg->simplify());
+    return *this;
 }
 
-NodeSin::NodeSin(unique_ptr<NodeBase> arg)
-    : UnaryNodeBase(std::move(arg), unaryPrecedence) {
-}
+Printer& Printer::operator<<(std::string_view text) {
+    out += text;
+    spill();
 
-int NodeSin::evaluate() const {
-    return sin(arg->evaluate() * M_PI / 180); // convert to radians
+    return *this;
 }
 
-string NodeSin::toString() const {
-    return "sin(" + arg->toString() + ")";
-}
+Printer& Printer::operator<<(int val) {
+    char digits[16];
+    char* end = std::to_chars(digits, digits + sizeof(digits), val).ptr;
+    out.append(digits, end);
+    spill();
 
-unique_ptr<NodeBase> NodeSin::clone() const {
-    return make_unique<NodeSin>(arg->clone());
+    return *this;
 }
 
-unique_ptr<NodeBase> NodeSin::differentiate(char wrt) const {
-    return make_unique<NodeMultiply>(arg->differentiate(wrt), make_unique<NodeCos>(arg->clone()));
+void Printer::flush() {
+    if (stream != nullptr) {
+        stream->write(out.data(), out.size());
+        out.clear();
+    }
 }
 
-unique_ptr<NodeBase> NodeSin::simplify() const {
-    unique_ptr<NodeBase> argSimple = arg->simplify();
-
-    // check for special simplification rules
-    NodeVal* leftVal = dynamic_cast<NodeVal*>(argSimple.get());
-
-    if (leftVal != nullptr && argSimple->evaluate() == 0) {
-        return make_unique<NodeVal>(0);
-    } else {
-        return make_unique<NodeSin>(std::move(argSimple));
+void Printer::spill() {
+    if (stream != nullptr && out.size() >= printChunk) {
+        flush();
     }
 }
 
-NodeCos::NodeCos(unique_ptr<NodeBase> arg)
-    : UnaryNodeBase(std::move(arg), unaryPrecedence) {
+NodeBase::NodeBase(NodeType type, int precedence) : type(type), precedence(precedence), normalized(false) {
 }
 
-int NodeCos::evaluate() const {
-    return cos(arg->evaluate() * M_PI / 180); // convert to radians
+int NodeBase::evaluate() const {
+    return evaluate(Bindings{});
 }
 
-string NodeCos::toString() const {
-    return "cos(" + arg->toString() + ")";
+string NodeBase::toString() const {
+    string out;
+    Printer printer(out);
+    print(printer);
+
+    return out;
 }
 
-unique_ptr<NodeBase> NodeCos::clone() const {
-    return make_unique<NodeCos>(arg->clone());
+void NodeBase::write(std::ostream& stream) const {
+    string out;
+    out.reserve(printChunk);
+    Printer printer(out, &stream);
+    print(printer);
+    printer.flush();
 }
 
-unique_ptr<NodeBase> NodeCos::differentiate(char wrt) const {
-    return make_unique<NodeMultiply>
-           (make_unique<NodeAddInverse>(arg->differentiate(wrt)), make_unique<NodeSin>(arg->clone()));
+int NodeBase::getPrecedence() const {
+    return precedence;
 }
 
-unique_ptr<NodeBase> NodeCos::simplify() const {
-    unique_ptr<NodeBase> argSimple = arg->simplify();
+NodeType NodeBase::getType() const {
+    return type;
+}
+
+bool NodeBase::isNormalized() const {
+    return normalized;
+}
+
+void NodeBase::setNormalized(bool normalized) {
+    this->normalized = normalized;
+}
+
+unique_ptr<NodeBase> NodeBase::differentiate(Symbol wrt, TreeCache* cache, ForkJoinPool* pool) const {
+    // a node to differentiate; once ready, the derivatives of its operands are on top of derivatives
+    struct Frame {
+        const NodeBase* node;
+        ForkJoinPool* pool;
+        Split split; // of a binary node's operands, which are each passed the pool only if large
+        bool sharedRight; // a divisor whose derivative comes from the cache
+        bool ready;
+    };
+
+    std::vector<unique_ptr<NodeBase>> derivatives; // of finished subtrees, operands in order
+    std::vector<Frame> frames{{this, pool, {false, false}, false, false}};
+
+    while (! frames.empty()) {
+        Frame frame = frames.back();
+        frames.pop_back();
+        const NodeBase& node = *frame.node;
+
+        if (node.type == NodeType::Val || node.type == NodeType::Var) {
+            derivatives.push_back(chainRule(node, wrt, nullptr, nullptr));
+        } else if (node.type < NodeType::Add) {
+            const NodeBase& arg = static_cast<const UnaryNodeBase&>(node).getArg();
+
+            if (! frame.ready && node.type != NodeType::AddInverse && shared(arg, cache)) {
+                derivatives.push_back(chainRule(node, wrt, derivative(arg, wrt, cache, frame.pool), nullptr));
+            } else if (! frame.ready) {
+                frames.push_back({&node, frame.pool, {false, false}, false, true});
+                frames.push_back({&arg, frame.pool, {false, false}, false, false});
+            } else {
+                derivatives.back() = chainRule(node, wrt, std::move(derivatives.back()), nullptr);
+            }
+        } else if (! frame.ready) {
+            const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(node);
+            // the power rule takes a constant exponent, so only the base is differentiated
+            Split split = frame.pool != nullptr && node.type != NodeType::Exponent ? measure(binary.getLeft(), binary.getRight(), forkNodes)
+                                                                                  : Split{false, false};
+
+            if (split.leftLarge && split.rightLarge) {
+                derivatives.push_back(forkedDerivative(binary, wrt, cache, frame.pool));
+                continue;
+            }
+
+            bool sharedRight = node.type == NodeType::Divide && shared(binary.getRight(), cache);
+            frames.push_back({&node, frame.pool, split, sharedRight, true});
+
+            if (node.type != NodeType::Exponent && ! sharedRight) {
+                frames.push_back({&binary.getRight(), split.rightLarge ? frame.pool : nullptr, {false, false}, false, false});
+            }
+
+            frames.push_back({&binary.getLeft(), node.type == NodeType::Exponent || split.leftLarge ? frame.pool : nullptr, {false, false}, false, false});
+        } else {
+            unique_ptr<NodeBase> r;
+
+            if (frame.sharedRight) {
+                r = derivative(static_cast<const BinaryNodeBase&>(node).getRight(), wrt, cache, frame.split.rightLarge ? frame.pool : nullptr);
+            } else if (node.type != NodeType::Exponent) {
+                r = std::move(derivatives.back());
+                derivatives.pop_back();
+            }
+
+            derivatives.back() = chainRule(node, wrt, std::move(derivatives.back()), std::move(r));
+        }
+    }
 
-    // check for special simplification rules
-    NodeVal* leftVal = dynamic_cast<NodeVal*>(argSimple.get());
+    return std::move(derivatives.back());
+}
+
+unique_ptr<NodeBase> NodeBase::clone() const {
+    thread_local std::vector<unique_ptr<NodeBase>> built; // finished copies, operands in order
+    thread_local std::vector<std::pair<const NodeBase*, bool>> stack; // nodes to copy, and whether their operands are copied
+    built.clear();
+    stack.assign(1, {this, false});
+
+    while (! stack.empty()) {
+        auto [next, ready] = stack.back();
+        stack.pop_back();
+
+        if (ready) {
+            if (next->type >= NodeType::Add) {
+                unique_ptr<NodeBase> right = std::move(built.back());
+                built.pop_back();
+                built.back() = makeBinaryNode(next->type, std::move(built.back()), std::move(right));
+            } else {
+                built.back() = makeUnaryNode(next->type, std::move(built.back()));
+            }
+
+            continue;
+        }
+
+        // the first operands are copied in hand, the rest wait on the stack
+        while (next->type != NodeType::Val && next->type != NodeType::Var) {
+            stack.emplace_back(next, true);
+
+            if (next->type >= NodeType::Add) {
+                const BinaryNodeBase& binary = static_cast<const BinaryNodeBase&>(*next);
+                stack.emplace_back(&binary.getRight(), false);
+                next = &binary.getLeft();
+            } else {
+                next = &static_cast<const UnaryNodeBase&>(*next).getArg();
+            }
+        }
+
+        if (next->type == NodeType::Val) {
+            built.push_back(make_unique<NodeVal>(static_cast<const NodeVal&>(*next)));
+        } else {
+            built.push_back(make_unique<NodeVar>(static_cast<const NodeVar&>(*next)));
+        }
+    }
 
-    if (leftVal != nullptr && argSimple->evaluate() == 0) {
-        return make_unique<NodeVal>(1);
-    } else {
-        return make_unique<NodeCos>(std::move(argSimple));
+    unique_ptr<NodeBase> copy = std::move(built.back());
+    built.pop_back();
+
+    return copy;
+}
+
+unique_ptr<NodeBase> NodeBase::simplify() const {
+    return ::simplify(clone());
+}
+
+void NodeBase::print(Printer& out) const {
+    // what is left of an operator once its first operand is printed, innermost last:
+    // the closing parenthesis, if any, then unless right is null the operator and right
+    struct Rest {
+        char close;
+        char op;
+        bool rightParens;
+        const NodeBase* right;
+    };
+
+    thread_local std::vector<Rest> rests; // kept between calls to save allocating
+    rests.clear();
+    const NodeBase* node = this;
+
+    while (true) {
+        // print node up to its first operand, which is printed next
+        switch (node->type) {
+            case NodeType::Val:
+                out << static_cast<const NodeVal*>(node)->val;
+                node = nullptr;
+                break;
+            case NodeType::Var:
+                out << symbolName(static_cast<const NodeVar*>(node)->symbol);
+                node = nullptr;
+                break;
+            case NodeType::AddInverse: {
+                const NodeBase* arg = &static_cast<const UnaryNodeBase*>(node)->getArg();
+
+                // an operand that binds less tightly goes in parentheses
+                if (node->precedence > arg->precedence) {
+                    out << "-(";
+                    rests.push_back({')', 0, false, nullptr});
+                } else {
+                    out << '-';
+                }
+
+                node = arg;
+                break;
+            }
+            case NodeType::Sin:
+            case NodeType::Cos:
+            case NodeType::Exp:
+            case NodeType::Log:
+                out << (node->type == NodeType::Sin ? "sin(" : node->type == NodeType::Cos ? "cos(" : node->type == NodeType::Exp ? "exp(" : "log(");
+                rests.push_back({')', 0, false, nullptr});
+                node = &static_cast<const UnaryNodeBase*>(node)->getArg();
+                break;
+            default: {
+                const BinaryNodeBase* binary = static_cast<const BinaryNodeBase*>(node);
+                const NodeBase* left = &binary->getLeft();
+                const NodeBase* right = &binary->getRight();
+                bool leftParens = left->precedence < node->precedence;
+                // operators group to the left, so a right operand of equal precedence needs parentheses unless the operator is + or *
+                bool rightParens = node->type == NodeType::Add || node->type == NodeType::Multiply ? right->precedence < node->precedence
+                                                                                                   : right->precedence <= node->precedence;
+                char op = node->type == NodeType::Add ? '+'
+                          : node->type == NodeType::Subtract ? '-'
+                          : node->type == NodeType::Multiply ? '*'
+                          : node->type == NodeType::Divide ? '/' : '^';
+
+                if (leftParens) {
+                    out << '(';
+                }
+
+                rests.push_back({leftParens ? ')' : '\0', op, rightParens, right});
+                node = left;
+                break;
+            }
+        }
+
+        while (node == nullptr && ! rests.empty()) {
+            Rest rest = rests.back();
+            rests.pop_back();
+
+            if (rest.close != '\0') {
+                out << rest.close;
+            }
+
+            if (rest.right != nullptr) {
+                out << rest.op;
+
+                if (rest.rightParens) {
+                    out << '(';
+                    rests.push_back({')', 0, false, nullptr});
+                }
+
+                node = rest.right;
+            }
+        }
+
+        if (node == nullptr) {
+            return;
+        }
     }
 }
 
-NodeExp::NodeExp(unique_ptr<NodeBase> arg)
-    : UnaryNodeBase(std::move(arg), unaryPrecedence) {
-}
+size_t NodeBase::hash() const {
+    std::vector<size_t> hashes; // of finished subtrees, operands in order
+    std::vector<std::pair<const NodeBase*, bool>> stack{{this, false}}; // subtrees to hash, and whether their operands are
+
+    while (! stack.empty()) {
+        auto [node, ready] = stack.back();
+        stack.pop_back();
+        size_t h = mix(0, static_cast<unsigned long long>(node->type));
+
+        if (node->type == NodeType::Val) {
+            hashes.push_back(mix(h, static_cast<unsigned int>(static_cast<const NodeVal*>(node)->val)));
+        } else if (node->type == NodeType::Var) {
+            hashes.push_back(mix(h, static_cast<const NodeVar*>(node)->symbol));
+        } else if (! ready) {
+            stack.emplace_back(node, true);
+
+            if (node->type >= NodeType::Add) {
+                const BinaryNodeBase* binary = static_cast<const BinaryNodeBase*>(node);
+                stack.emplace_back(&binary->getRight(), false);
+                stack.emplace_back(&binary->getLeft(), false);
+            } else {
+                stack.emplace_back(&static_cast<const UnaryNodeBase*>(node)->getArg(), false);
+            }
+        } else if (node->type >= NodeType::Add) {
+            size_t right = hashes.back();
+            hashes.pop_back();
+            hashes.back() = mix(mix(h, hashes.back()), right);
+        } else {
+            hashes.back() = mix(h, hashes.back());
+        }
+    }
 
-int NodeExp::evaluate() const {
-    return exp(arg->evaluate());
-}
+    return hashes.back();
+}
+
+bool NodeBase::equals(const NodeBase& other) const {
+    std::vector<std::pair<const NodeBase*, const NodeBase*>> stack{{this, &other}}; // pairs of subtrees still to compare
+
+    while (! stack.empty()) {
+        auto [x, y] = stack.back();
+        stack.pop_back();
+
+        if (x->type != y->type) {
+            return false;
+        } else if (x->type == NodeType::Val) {
+            if (static_cast<const NodeVal*>(x)->val != static_cast<const NodeVal*>(y)->val) {
+                return false;
+            }
+        } else if (x->type == NodeType::Var) {
+            if (static_cast<const NodeVar*>(x)->symbol != static_cast<const NodeVar*>(y)->symbol) {
+                return false;
+            }
+        } else if (x->type >= NodeType::Add) {
+            const BinaryNodeBase* a = static_cast<const BinaryNodeBase*>(x);
+            const BinaryNodeBase* b = static_cast<const BinaryNodeBase*>(y);
+            stack.emplace_back(&a->getRight(), &b->getRight());
+            stack.emplace_back(&a->getLeft(), &b->getLeft());
+        } else {
+            stack.emplace_back(&static_cast<const UnaryNodeBase*>(x)->getArg(), &static_cast<const UnaryNodeBase*>(y)->getArg());
+        }
+    }
 
-string NodeExp::toString() const {
-    return "exp(" + arg->toString() + ")";
+    return true;
 }
 
-unique_ptr<NodeBase> NodeExp::clone() const {
-    return make_unique<NodeExp>(arg->clone());
+UnaryNodeBase::UnaryNodeBase(unique_ptr<NodeBase> arg, NodeType type, int precedence)
+    : NodeBase(type, precedence), arg(std::move(arg)) {
 }
 
-unique_ptr<NodeBase> NodeExp::differentiate(char wrt) const {
-    return make_unique<NodeMultiply>(arg->differentiate(wrt), make_unique<NodeExp>(arg->clone()));
+UnaryNodeBase::~UnaryNodeBase() {
+    dispose(arg);
 }
 
-unique_ptr<NodeBase> NodeExp::simplify() const {
-    unique_ptr<NodeBase> argSimple = arg->simplify();
-
-    // check for special simplification rules
-    NodeVal* leftVal = dynamic_cast<NodeVal*>(argSimple.get());
-
-    if (leftVal != nullptr && argSimple->evaluate() == 0) {
-        return make_unique<NodeVal>(1);
-    } else {
-        return make_unique<NodeExp>(std::move(argSimple));
-    }
+const NodeBase& UnaryNodeBase::getArg() const {
+    return *arg;
 }
 
-NodeLog::NodeLog(unique_ptr<NodeBase> arg)
-    : UnaryNodeBase(std::move(arg), unaryPrecedence) {
+unique_ptr<NodeBase>& UnaryNodeBase::getArgPtr() {
+    return arg;
 }
 
-int NodeLog::evaluate() const {
-    return log(arg->evaluate());
+BinaryNodeBase::BinaryNodeBase(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right, NodeType type, int precedence)
+    : NodeBase(type, precedence), left(std::move(left)), right(std::move(right)) {
 }
 
-string NodeLog::toString() const {
-    return "log(" + arg->toString() + ")";
+BinaryNodeBase::~BinaryNodeBase() {
+    dispose(left);
+    dispose(right);
 }
 
-unique_ptr<NodeBase> NodeLog::clone() const {
-    return make_unique<NodeLog>(arg->clone());
+const NodeBase& BinaryNodeBase::getLeft() const {
+    return *left;
 }
 
-unique_ptr<NodeBase> NodeLog::differentiate(char wrt) const {
-    return make_unique<NodeDivide>(arg->differentiate(wrt), arg->clone());
+const NodeBase& BinaryNodeBase::getRight() const {
+    return *right;
 }
 
-unique_ptr<NodeBase> NodeLog::simplify() const {
-    unique_ptr<NodeBase> argSimple = arg->simplify();
-
-    // check for special simplification rules
-    NodeVal* leftVal = dynamic_cast<NodeVal*>(argSimple.get());
-
-    if (leftVal != nullptr && argSimple->evaluate() == 1) {
-        return make_unique<NodeVal>(0);
-    } else {
-        return make_unique<NodeLog>(std::move(argSimple));
-    }
+unique_ptr<NodeBase>& BinaryNodeBase::getLeftPtr() {
+    return left;
 }
 
-NodeAdd::NodeAdd(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
-    : BinaryNodeBase(std::move(left), std::move(right), addPrecedence) {
+unique_ptr<NodeBase>& BinaryNodeBase::getRightPtr() {
+    return right;
 }
 
-int NodeAdd::evaluate() const {
-    return left->evaluate() + right->evaluate();
+NodeVal::NodeVal(int val) : NodeBase(NodeType::Val, valPrecedence), val(val) {
 }
 
-string NodeAdd::toString() const {
-    string leftString;
-    string rightString;
-
-    if (left->getPrecedence() < precedence) {
-        leftString = "(" + left->toString() + ")";
-    } else {
-        leftString = left->toString();
-    }
-
-    if (right->getPrecedence() < precedence) {
-        rightString = "(" + right->toString() + ")";
-    } else {
-        rightString = right->toString();
-    }
-
-    return leftString + "+" + rightString;
+int NodeVal::evaluate(const Bindings&) const {
+    return val;
 }
 
-unique_ptr<NodeBase> NodeAdd::clone() const {
-    return make_unique<NodeAdd>(left->clone(), right->clone());
-}
 
-unique_ptr<NodeBase> NodeAdd::differentiate(char wrt) const {
-    return make_unique<NodeAdd>(left->differentiate(wrt), right->differentiate(wrt));
+NodeVar::NodeVar(Symbol symbol)
+    : NodeBase(NodeType::Var, valPrecedence), symbol(symbol) {
 }
 
-unique_ptr<NodeBase> NodeAdd::simplify() const {
-    unique_ptr<NodeBase> leftSimple = left->simplify();
-    unique_ptr<NodeBase> rightSimple = right->simplify();
-
-    NodeBase* leftVal = dynamic_cast<NodeVal*>(leftSimple.get());
-    NodeBase* rightVal = dynamic_cast<NodeVal*>(rightSimple.get());
-
-    // check for special simplification rules
-    if (leftVal != nullptr && rightVal != nullptr) {
-        return make_unique<NodeVal>(leftVal->evaluate() + rightVal->evaluate());
-    } else if (leftVal != nullptr && leftVal->evaluate() == 0) {
-        return rightSimple;
-    } else if (rightVal != nullptr && rightVal->evaluate() == 0) {
-        return leftSimple;
-    } else {
-        return make_unique<NodeAdd>(std::move(leftSimple), std::move(rightSimple));
-    }
+int NodeVar::evaluate(const Bindings& bindings) const {
+    return bindings[symbol];
 }
 
-NodeSubtract::NodeSubtract(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
-    : BinaryNodeBase(std::move(left), std::move(right), addPrecedence) {
-}
 
-int NodeSubtract::evaluate() const {
-    return left->evaluate() - right->evaluate();
+NodeAddInverse::NodeAddInverse(unique_ptr<NodeBase> arg)
+    : UnaryNodeBase(std::move(arg), NodeType::AddInverse, unaryPrecedence) {
 }
 
-string NodeSubtract::toString() const {
-    string leftString;
-    string rightString;
-
-    if (left->getPrecedence() < precedence) {
-        leftString = "(" + left->toString() + ")";
-    } else {
-        leftString = left->toString();
-    }
-
-    if (right->getPrecedence() < precedence) {
-        rightString = "(" + right->toString() + ")";
-    } else {
-        rightString = right->toString();
-    }
-
-    return leftString + "-" + rightString;
+int NodeAddInverse::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return -1 * arg->evaluate(bindings);
 }
 
-unique_ptr<NodeBase> NodeSubtract::clone() const {
-    return make_unique<NodeSubtract>(left->clone(), right->clone());
-}
 
-unique_ptr<NodeBase> NodeSubtract::differentiate(char wrt) const {
-    return make_unique<NodeSubtract>(left->differentiate(wrt), right->differentiate(wrt));
+NodeSin::NodeSin(unique_ptr<NodeBase> arg)
+    : UnaryNodeBase(std::move(arg), NodeType::Sin, unaryPrecedence) {
 }
 
-unique_ptr<NodeBase> NodeSubtract::simplify() const {
-    unique_ptr<NodeBase> leftSimple = left->simplify();
-    unique_ptr<NodeBase> rightSimple = right->simplify();
-
-    NodeBase* leftVal = dynamic_cast<NodeVal*>(leftSimple.get());
-    NodeBase* rightVal = dynamic_cast<NodeVal*>(rightSimple.get());
-
-    // check for special simplification rules
-    if (leftVal != nullptr && rightVal != nullptr) {
-        return make_unique<NodeVal>(leftVal->evaluate() - rightVal->evaluate());
-    } else if (leftVal != nullptr && leftVal->evaluate() == 0) {
-        return make_unique<NodeAddInverse>(std::move(rightSimple));
-    } else if (rightVal != nullptr && rightVal->evaluate() == 0) {
-        return leftSimple;
-    } else {
-        return make_unique<NodeSubtract>(std::move(leftSimple), std::move(rightSimple));
-    }
+int NodeSin::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return sin(arg->evaluate(bindings));
 }
 
-NodeMultiply::NodeMultiply(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
-    : BinaryNodeBase(std::move(left), std::move(right), multiplyPrecedence) {
-}
 
-int NodeMultiply::evaluate() const {
-    return left->evaluate() * right->evaluate();
+NodeCos::NodeCos(unique_ptr<NodeBase> arg)
+    : UnaryNodeBase(std::move(arg), NodeType::Cos, unaryPrecedence) {
 }
 
-string NodeMultiply::toString() const {
-    string leftString;
-    string rightString;
-
-    if (left->getPrecedence() < precedence) {
-        leftString = "(" + left->toString() + ")";
-    } else {
-        leftString = left->toString();
-    }
-
-    if (right->getPrecedence() < precedence) {
-        rightString = "(" + right->toString() + ")";
-    } else {
-        rightString = right->toString();
-    }
-
-    return leftString + "*" + rightString;
+int NodeCos::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return cos(arg->evaluate(bindings));
 }
 
-unique_ptr<NodeBase> NodeMultiply::clone() const {
-    return make_unique<NodeMultiply>(left->clone(), right->clone());
-}
 
-unique_ptr<NodeBase> NodeMultiply::differentiate(char wrt) const {
-    return make_unique<NodeAdd>(make_unique<NodeMultiply>(left->differentiate(wrt), right->clone()),
-                                make_unique<NodeMultiply>(left->clone(), right->differentiate(wrt)));
+NodeExp::NodeExp(unique_ptr<NodeBase> arg)
+    : UnaryNodeBase(std::move(arg), NodeType::Exp, unaryPrecedence) {
 }
 
-unique_ptr<NodeBase> NodeMultiply::simplify() const {
-    unique_ptr<NodeBase> leftSimple = left->simplify();
-    unique_ptr<NodeBase> rightSimple = right->simplify();
-
-    // check for special simplification rules
-    NodeBase* leftVal = dynamic_cast<NodeVal*>(leftSimple.get());
-    NodeBase* rightVal = dynamic_cast<NodeVal*>(rightSimple.get());
-
-    if (leftVal != nullptr && rightVal != nullptr) {
-        return make_unique<NodeVal>(leftVal->evaluate() * rightVal->evaluate());
-    } else if (leftVal != nullptr && leftVal->evaluate() == 1) {
-        return rightSimple;
-    } else if (leftVal != nullptr && leftVal->evaluate() == -1) {
-        return make_unique<NodeAddInverse>(std::move(rightSimple));
-    } else if (leftVal != nullptr && leftVal->evaluate() == 0) {
-        return make_unique<NodeVal>(0);
-    } else if (rightVal != nullptr && rightVal->evaluate() == 1) {
-        return leftSimple;
-    } else if (rightVal != nullptr && rightVal->evaluate() == -1) {
-        return make_unique<NodeAddInverse>(std::move(leftSimple));
-    } else if (rightVal != nullptr && rightVal->evaluate() == 0) {
-        return make_unique<NodeVal>(0);
-    } else {
-        return make_unique<NodeMultiply>(std::move(leftSimple), std::move(rightSimple));
-    }
+int NodeExp::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return exp(arg->evaluate(bindings));
 }
 
-NodeDivide::NodeDivide(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
-    : BinaryNodeBase(std::move(left), std::move(right), multiplyPrecedence) {
-}
 
-int NodeDivide::evaluate() const {
-    return left->evaluate() / right->evaluate();
+NodeLog::NodeLog(unique_ptr<NodeBase> arg)
+    : UnaryNodeBase(std::move(arg), NodeType::Log, unaryPrecedence) {
 }
 
-string NodeDivide::toString() const {
-    string leftString;
-    string rightString;
-
-    if (left->getPrecedence() < precedence) {
-        leftString = "(" + left->toString() + ")";
-    } else {
-        leftString = left->toString();
-    }
+int NodeLog::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return log(arg->evaluate(bindings));
+}
 
-    if (right->getPrecedence() < precedence) {
-        rightString = "(" + right->toString() + ")";
-    } else {
-        rightString = right->toString();
-    }
 
-    return leftString + "/" + rightString;
+NodeAdd::NodeAdd(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
+    : BinaryNodeBase(std::move(left), std::move(right), NodeType::Add, addPrecedence) {
 }
 
-unique_ptr<NodeBase> NodeDivide::clone() const {
-    return make_unique<NodeDivide>(left->clone(), right->clone());
+int NodeAdd::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return left->evaluate(bindings) + right->evaluate(bindings);
 }
 
-unique_ptr<NodeBase> NodeDivide::differentiate(char wrt) const {
-    return make_unique<NodeDivide>(make_unique<NodeSubtract>(
-        make_unique<NodeMultiply>(left->differentiate(wrt), right->clone()),
-        make_unique<NodeMultiply>(right->differentiate(wrt), left->clone())),
-        make_unique<NodeExponent>(right->clone(), make_unique<NodeVal>(2)));
+
+NodeSubtract::NodeSubtract(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
+    : BinaryNodeBase(std::move(left), std::move(right), NodeType::Subtract, addPrecedence) {
 }
 
-unique_ptr<NodeBase> NodeDivide::simplify() const {
-    unique_ptr<NodeBase> leftSimple = left->simplify();
-    unique_ptr<NodeBase> rightSimple = right->simplify();
+int NodeSubtract::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return left->evaluate(bindings) - right->evaluate(bindings);
+}
 
-    NodeBase* leftVal = dynamic_cast<NodeVal*>(leftSimple.get());
-    NodeBase* rightVal = dynamic_cast<NodeVal*>(rightSimple.get());
 
-    // check for special simplification rules
-    if (leftVal != nullptr && rightVal != nullptr) {
-        return make_unique<NodeVal>(leftVal->evaluate() * rightVal->evaluate());
-    } else if (leftVal != nullptr && leftVal->evaluate() == 0) {
-        return make_unique<NodeVal>(0);
-    } else if (rightVal != nullptr && rightVal->evaluate() == 1) {
-        return leftSimple;
-    } else if (rightVal != nullptr && rightVal->evaluate() == -1) {
-        return make_unique<NodeAddInverse>(std::move(leftSimple));
-    } else {
-        return make_unique<NodeDivide>(std::move(leftSimple), std::move(rightSimple));;
-    }
+NodeMultiply::NodeMultiply(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
+    : BinaryNodeBase(std::move(left), std::move(right), NodeType::Multiply, multiplyPrecedence) {
 }
 
-NodeExponent::NodeExponent(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
-    : BinaryNodeBase(std::move(left), std::move(right), exponentPrecedence) {
+int NodeMultiply::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return left->evaluate(bindings) * right->evaluate(bindings);
 }
 
-int NodeExponent::evaluate() const {
-    return pow(left->evaluate(), right->evaluate());
+
+NodeDivide::NodeDivide(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
+    : BinaryNodeBase(std::move(left), std::move(right), NodeType::Divide, multiplyPrecedence) {
 }
 
-string NodeExponent::toString() const {
-    string leftString;
-    string rightString;
+int NodeDivide::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return left->evaluate(bindings) / right->evaluate(bindings);
+}
 
-    if (left->getPrecedence() < precedence) {
-        leftString = "(" + left->toString() + ")";
-    } else {
-        leftString = left->toString();
-    }
 
-    if (right->getPrecedence() <= precedence) {
-        rightString = "(" + right->toString() + ")";
-    } else {
-        rightString = right->toString();
+NodeExponent::NodeExponent(unique_ptr<NodeBase> left, unique_ptr<NodeBase> right)
+    : BinaryNodeBase(std::move(left), std::move(right), NodeType::Exponent, exponentPrecedence) {
+}
+
+int NodeExponent::evaluate(const Bindings& bindings) const {
+    checkStack();
+    return pow(left->evaluate(bindings), right->evaluate(bindings));
+}
+
+
+int getPrecedence(NodeType type) {
+    switch (type) {
+        case NodeType::Val:
+        case NodeType::Var:
+            return valPrecedence;
+        case NodeType::AddInverse:
+        case NodeType::Sin:
+        case NodeType::Cos:
+        case NodeType::Exp:
+        case NodeType::Log:
+            return unaryPrecedence;
+        case NodeType::Exponent:
+            return exponentPrecedence;
+        case NodeType::Multiply:
+        case NodeType::Divide:
+            return multiplyPrecedence;
+        default:
+            return addPrecedence;
     }
-
-    return leftString + "^" + rightString;
-}
-
-unique_ptr<NodeBase> NodeExponent::clone() const {
-    return make_unique<NodeExponent>(left->clone(), right->clone());
 }
 
-// power rule
-unique_ptr<NodeBase> NodeExponent::differentiate(char wrt) const {
-    return make_unique<NodeMultiply>(left->differentiate(wrt),
-                                    make_unique<NodeMultiply>(make_unique<NodeVal>(right->evaluate()),
-                                                              make_unique<NodeExponent>(left->clone(),
-                                                                                        make_unique<NodeVal>(right->evaluate() - 1))));
+unique_ptr<NodeBase> makeUnaryNode(NodeType type, unique_ptr<NodeBase> arg) {
+    switch (type) {
+        case NodeType::AddInverse:
+            return make_unique<NodeAddInverse>(std::move(arg));
+        case NodeType::Sin:
+            return make_unique<NodeSin>(std::move(arg));
+        case NodeType::Cos:
+            return make_unique<NodeCos>(std::move(arg));
+        case NodeType::Exp:
+            return make_unique<NodeExp>(std::move(arg));
+        default:
+            return make_unique<NodeLog>(std::move(arg));
+    }
 }
 
-unique_ptr<NodeBase> NodeExponent::simplify() const {
-    unique_ptr<NodeBase> leftSimple = left->simplify();
-    unique_ptr<NodeBase> rightSimple = right->simplify();
-
-    NodeBase* leftVal = dynamic_cast<NodeVal*>(leftSimple.get());
-    NodeBase* rightVal = dynamic_cast<NodeVal*>(rightSimple.get());
-
-    // check for special simplification rules
-    if (leftVal != nullptr && rightVal != nullptr) {
-        return make_unique<NodeVal>(leftVal->evaluate() * rightVal->evaluate());
-    } else if (leftVal != nullptr && leftVal->evaluate() == 0) {
-        return make_unique<NodeVal>(0);
-    } else if (leftVal != nullptr && leftVal->evaluate() == 1) {
-        return make_unique<NodeVal>(1);
-    } else if (rightVal != nullptr && rightVal->evaluate() == 0) {
-        return make_unique<NodeVal>(1);
-    } else if (rightVal != nullptr && rightVal->evaluate() == 1) {
-        return leftSimple;
-    } else {
-        return clone();
+unique_ptr<NodeBase> makeBinaryNode(NodeType type, unique_ptr<NodeBase> left, unique_ptr<NodeBase> right) {
+    switch (type) {
+        case NodeType::Add:
+            return make_unique<NodeAdd>(std::move(left), std::move(right));
+        case NodeType::Subtract:
+            return make_unique<NodeSubtract>(std::move(left), std::move(right));
+        case NodeType::Multiply:
+            return make_unique<NodeMultiply>(std::move(left), std::move(right));
+        case NodeType::Divide:
+            return make_unique<NodeDivide>(std::move(left), std::move(right));
+        default:
+            return make_unique<NodeExponent>(std::move(left), std::move(right));
     }
 }
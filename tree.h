@@ -1,8 +1,12 @@
 #pragma once
 
+#include "symbol.h"
+
+#include <iosfwd>
 #include <memory>
 #include <cmath>
 #include <string>
+#include <string_view>
 
 /*
 Precedence for nodes (order of operations):
@@ -13,31 +17,83 @@ Precedence for nodes (order of operations):
 1: NodeAdd, NodeSubtract
 */
 
+enum class NodeType : unsigned char {Val, Var, AddInverse, Sin, Cos, Exp, Log, Add, Subtract, Multiply, Divide, Exponent};
+
+// values for variable symbols, unbound symbols evaluate to 0
+using Bindings = SymbolValues<int>;
+
+class TreeCache;
+class ForkJoinPool;
+
+// text output for print(); with a stream, the text is handed on in chunks rather than kept whole
+class Printer {
+public:
+    Printer(std::string& out, std::ostream* stream = nullptr);
+
+    Printer& operator<<(char c);
+
+    Printer& operator<<(std::string_view text);
+
+    Printer& operator<<(int val);
+
+    void flush(); // hands the text buffered in out on to the stream
+
+private:
+    void spill(); // flushes once out has grown past a chunk
+
+    std::string& out;
+    std::ostream* stream;
+};
+
 class NodeBase {
 public:
-    NodeBase(int precedence);
+    NodeBase(NodeType type, int precedence);
     virtual ~NodeBase() = default;
 
-    virtual int evaluate() const = 0;
+    virtual int evaluate(const Bindings& bindings) const = 0; // truncates every step to int, sin/cos take radians
+
+    int evaluate() const;
+
+    std::string toString() const;
 
-    virtual std::string toString() const = 0;
+    void write(std::ostream& stream) const; // prints to stream without building the whole string
 
-    virtual std::unique_ptr<NodeBase> differentiate(char wrt) const = 0;
+    void print(Printer& out) const; // appends the text to out
 
-    virtual std::unique_ptr<NodeBase> clone() const = 0;
+    // with a cache, derivatives of small function arguments and divisors come simplified from it, see derivative() in rewrite.h;
+    // with a pool, the operands of large binary nodes are differentiated in parallel, see parallel.h
+    std::unique_ptr<NodeBase> differentiate(Symbol wrt, TreeCache* cache = nullptr, ForkJoinPool* pool = nullptr) const;
 
-    virtual std::unique_ptr<NodeBase> simplify() const = 0;
+    std::unique_ptr<NodeBase> clone() const;
+
+    std::unique_ptr<NodeBase> simplify() const; // simplifies a copy, see rewrite.h
+
+    size_t hash() const; // structurally equal trees hash equally
+
+    bool equals(const NodeBase& other) const; // structural equality
 
     int getPrecedence() const;
 
+    NodeType getType() const;
+
+    bool isNormalized() const;
+
+    void setNormalized(bool normalized);
+
 protected:
+    const NodeType type;
     const int precedence;
+    bool normalized; // no simplification rule applies anywhere in this subtree
 };
 
 class UnaryNodeBase : public NodeBase {
 public:
-    UnaryNodeBase(std::unique_ptr<NodeBase> arg, int precedence);
-    virtual ~UnaryNodeBase() = default;
+    UnaryNodeBase(std::unique_ptr<NodeBase> arg, NodeType type, int precedence);
+    virtual ~UnaryNodeBase();
+
+    const NodeBase& getArg() const;
+
+    std::unique_ptr<NodeBase>& getArgPtr();
 
 protected:
     std::unique_ptr<NodeBase> arg;
@@ -45,8 +101,16 @@ protected:
 
 class BinaryNodeBase : public NodeBase {
 public:
-    BinaryNodeBase(std::unique_ptr<NodeBase> left, std::unique_ptr<NodeBase> right, int precedence);
-    virtual ~BinaryNodeBase() = default;
+    BinaryNodeBase(std::unique_ptr<NodeBase> left, std::unique_ptr<NodeBase> right, NodeType type, int precedence);
+    virtual ~BinaryNodeBase();
+
+    const NodeBase& getLeft() const;
+
+    const NodeBase& getRight() const;
+
+    std::unique_ptr<NodeBase>& getLeftPtr();
+
+    std::unique_ptr<NodeBase>& getRightPtr();
 
 protected:
     std::unique_ptr<NodeBase> left;
@@ -57,15 +121,7 @@ class NodeVal : public NodeBase {
 public:
     NodeVal(int val);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 
 public:
     int val;
@@ -73,168 +129,86 @@ public:
 
 class NodeVar : public NodeBase {
 public:
-    NodeVar(char symbol);
-
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
+    NodeVar(Symbol symbol);
 
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 
 public:
-    char symbol;
+    Symbol symbol;
 };
 
 class NodeAddInverse : public UnaryNodeBase {
 public:
     NodeAddInverse(std::unique_ptr<NodeBase> arg);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 };
 
 class NodeSin : public UnaryNodeBase {
 public:
     NodeSin(std::unique_ptr<NodeBase> arg);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 };
 
 class NodeCos : public UnaryNodeBase {
 public:
     NodeCos(std::unique_ptr<NodeBase> arg);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 };
 
 class NodeExp : public UnaryNodeBase {
 public:
     NodeExp(std::unique_ptr<NodeBase> arg);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 };
 
 class NodeLog : public UnaryNodeBase {
 public:
     NodeLog(std::unique_ptr<NodeBase> arg);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 };
 
 class NodeAdd : public BinaryNodeBase {
 public:
     NodeAdd(std::unique_ptr<NodeBase> left, std::unique_ptr<NodeBase> right);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 };
 
 class NodeSubtract : public BinaryNodeBase {
 public:
     NodeSubtract(std::unique_ptr<NodeBase> left, std::unique_ptr<NodeBase> right);
 
-    int evaluate() const override;
-    
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
-};
+    int evaluate(const Bindings& bindings) const override;
+    };
 
 class NodeMultiply : public BinaryNodeBase {
 public:
     NodeMultiply(std::unique_ptr<NodeBase> left, std::unique_ptr<NodeBase> right);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 };
 
 class NodeDivide : public BinaryNodeBase {
 public:
     NodeDivide(std::unique_ptr<NodeBase> left, std::unique_ptr<NodeBase> right);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
-
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
-
-    std::unique_ptr<NodeBase> simplify() const override;
+    int evaluate(const Bindings& bindings) const override;
 };
 
 class NodeExponent : public BinaryNodeBase {
 public:
     NodeExponent(std::unique_ptr<NodeBase> left, std::unique_ptr<NodeBase> right);
 
-    int evaluate() const override;
-
-    std::string toString() const override;
-
-    std::unique_ptr<NodeBase> clone() const override;
+    int evaluate(const Bindings& bindings) const override;
+};
 
-    std::unique_ptr<NodeBase> differentiate(char wrt) const override;
+int getPrecedence(NodeType type);
 
-    std::unique_ptr<NodeBase> simplify() const override;
-};
+// construct the node class matching type
+std::unique_ptr<NodeBase> makeUnaryNode(NodeType type, std::unique_ptr<NodeBase> arg);
+std::unique_ptr<NodeBase> makeBinaryNode(NodeType type, std::unique_ptr<NodeBase> left, std::unique_ptr<NodeBase> right);